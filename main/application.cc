@@ -8,6 +8,8 @@
 #include "websocket_protocol.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
+#include "latency_tracer.h"
+#include "settings.h"
 #include "assets/lang_config.h"
 
 #include <cstring>
@@ -36,7 +38,10 @@ static const char* const STATE_STRINGS[] = {
 
 Application::Application() {
     event_group_ = xEventGroupCreate();
-    background_task_ = new BackgroundTask(4096 * 8);
+    xEventGroupSetBits(event_group_, PREWARM_IDLE_EVENT);
+    // Only the encoder runs here, when it falls behind the oldest PCM frames are dropped,
+    // control callbacks wait for room instead
+    background_task_ = new BackgroundTask(4096 * 8, BACKGROUND_TASK_QUEUE_CAPACITY, kBackgroundTaskDropOldest);
 
     esp_timer_create_args_t clock_timer_args = {
         .callback = [](void* arg) {
@@ -108,10 +113,7 @@ void Application::CheckNewVersion() {
                 auto codec = board.GetAudioCodec();
                 codec->EnableInput(false);
                 codec->EnableOutput(false);
-                {
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    audio_decode_queue_.clear();
-                }
+                audio_playback_.Reset();
                 background_task_->WaitForCompletion();
                 delete background_task_;
                 background_task_ = nullptr;
@@ -182,10 +184,8 @@ void Application::ShowActivationCode() {
         digit_sound{'9', Lang::Sounds::P3_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
+    // The digits are queued behind the activation prompt and played in order
     Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Lang::Sounds::P3_ACTIVATION);
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    background_task_->WaitForCompletion();
 
     for (const auto& digit : code) {
         auto it = std::find_if(digit_sounds.begin(), digit_sounds.end(),
@@ -219,22 +219,8 @@ void Application::DismissAlert() {
 void Application::PlaySound(const std::string_view& sound) {
     auto codec = Board::GetInstance().GetAudioCodec();
     codec->EnableOutput(true);
-    SetDecodeSampleRate(16000);
-    const char* data = sound.data();
-    size_t size = sound.size();
-    for (const char* p = data; p < data + size; ) {
-        auto p3 = (BinaryProtocol3*)p;
-        p += sizeof(BinaryProtocol3);
-
-        auto payload_size = ntohs(p3->payload_size);
-        std::vector<uint8_t> opus;
-        opus.resize(payload_size);
-        memcpy(opus.data(), p3->payload, payload_size);
-        p += payload_size;
-
-        std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(opus));
-    }
+    audio_playback_.SetDecodeSampleRate(16000);
+    audio_playback_.PlaySound(sound);
 }
 
 void Application::ToggleChatState() {
@@ -251,12 +237,12 @@ void Application::ToggleChatState() {
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
             SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
+            if (!ConnectAudioChannel()) {
                 return;
             }
 
             keep_listening_ = true;
-            protocol_->SendStartListening(kListeningModeAutoStop);
+            protocol_->SendStartListening(listening_mode_);
             SetDeviceState(kDeviceStateListening);
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
@@ -286,7 +272,7 @@ void Application::StartListening() {
         Schedule([this]() {
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
+                if (!ConnectAudioChannel()) {
                     return;
                 }
             }
@@ -302,6 +288,127 @@ void Application::StartListening() {
     }
 }
 
+bool Application::HandleChatMessage(const char* type, const char* state, const char* text, const char* emotion) {
+    if (type == nullptr) {
+        return false;
+    }
+    auto display = Board::GetInstance().GetDisplay();
+    if (strcmp(type, "tts") == 0) {
+        if (state == nullptr) {
+            return true;
+        }
+        if (strcmp(state, "start") == 0) {
+            Schedule([this]() {
+                aborted_ = false;
+                if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                    SetDeviceState(kDeviceStateSpeaking);
+                }
+            });
+        } else if (strcmp(state, "stop") == 0) {
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateSpeaking) {
+                    audio_playback_.WaitForCompletion();
+#if CONFIG_AUDIO_LATENCY_TRACE
+                    // Both directions have been through a full turn, report what was measured so far
+                    protocol_->SendLatencyReport(LatencyTracer::GetInstance().GetJson());
+#endif
+                    if (keep_listening_) {
+                        protocol_->SendStartListening(listening_mode_);
+                        SetDeviceState(kDeviceStateListening);
+                    } else {
+                        SetDeviceState(kDeviceStateIdle);
+                    }
+                }
+            });
+        } else if (strcmp(state, "sentence_start") == 0 && text != nullptr) {
+            ESP_LOGI(TAG, "<< %s", text);
+            Schedule([this, display, message = std::string(text)]() {
+                display->SetChatMessage("assistant", message.c_str());
+            });
+        }
+        return true;
+    } else if (strcmp(type, "stt") == 0) {
+        if (text != nullptr) {
+            ESP_LOGI(TAG, ">> %s", text);
+            Schedule([this, display, message = std::string(text)]() {
+                display->SetChatMessage("user", message.c_str());
+            });
+        }
+        return true;
+    } else if (strcmp(type, "llm") == 0) {
+        if (emotion != nullptr) {
+            Schedule([this, display, emotion_str = std::string(emotion)]() {
+                display->SetEmotion(emotion_str.c_str());
+            });
+        }
+        return true;
+    }
+    return false;
+}
+
+void Application::PrewarmAudioChannel() {
+#if CONFIG_AUDIO_CHANNEL_PREWARM
+    // Called from button handlers, the state is checked on the main loop
+    Schedule([this]() {
+        if (device_state_ != kDeviceStateIdle || !protocol_ || protocol_->IsAudioChannelOpened()) {
+            return;
+        }
+        if (prewarming_.exchange(true)) {
+            return;
+        }
+        prewarm_attempts_++;
+        xEventGroupClearBits(event_group_, PREWARM_IDLE_EVENT);
+        // Only the transport connect and hello run on this task, so that wake word detection keeps
+        // running. The opened callback is scheduled back onto the main loop, errors are dropped.
+        auto ret = xTaskCreate([](void* arg) {
+            Application* app = (Application*)arg;
+            ESP_LOGI(TAG, "Prewarming audio channel");
+            if (app->protocol_->OpenAudioChannelDeferred()) {
+                app->prewarm_opened_pending_ = true;
+                app->Schedule([app]() {
+                    app->CompletePrewarm();
+                });
+            }
+            app->prewarming_ = false;
+            xEventGroupSetBits(app->event_group_, PREWARM_IDLE_EVENT);
+            vTaskDelete(NULL);
+        }, "prewarm_channel", 4096 * 2, this, 2, nullptr);
+        if (ret != pdPASS) {
+            prewarming_ = false;
+            xEventGroupSetBits(event_group_, PREWARM_IDLE_EVENT);
+        }
+    });
+#endif
+}
+
+void Application::CompletePrewarm() {
+    // Runs the opened callback once, from whichever comes first: the scheduled call or ConnectAudioChannel
+    if (prewarm_opened_pending_.exchange(false) && protocol_->IsAudioChannelOpened()) {
+        protocol_->NotifyAudioChannelOpened();
+    }
+}
+
+bool Application::ConnectAudioChannel() {
+#if CONFIG_AUDIO_CHANNEL_PREWARM
+    // Waits for a prewarm that is still connecting, the channel cannot be opened twice at once
+    auto bits = xEventGroupWaitBits(event_group_, PREWARM_IDLE_EVENT, pdFALSE, pdFALSE,
+        pdMS_TO_TICKS(PREWARM_WAIT_TIMEOUT_MS));
+    if (!(bits & PREWARM_IDLE_EVENT)) {
+        ESP_LOGE(TAG, "Prewarm still connecting after %d ms", PREWARM_WAIT_TIMEOUT_MS);
+        SetDeviceState(kDeviceStateIdle);
+        Alert(Lang::Strings::ERROR, Lang::Strings::SERVER_TIMEOUT, "sad", Lang::Sounds::P3_EXCLAMATION);
+        return false;
+    }
+    CompletePrewarm();
+    if (protocol_->IsAudioChannelOpened()) {
+        channel_hits_++;
+        return true;
+    }
+    channel_misses_++;
+#endif
+    return protocol_->OpenAudioChannel();
+}
+
 void Application::StopListening() {
     Schedule([this]() {
         if (device_state_ == kDeviceStateListening) {
@@ -320,33 +427,35 @@ void Application::Start() {
 
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
-    opus_decode_sample_rate_ = codec->output_sample_rate();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    {
+        Settings settings("audio", false);
+        frame_duration_ms_ = settings.GetInt("frame_duration", OPUS_FRAME_DURATION_MS);
+        if (!Protocol::IsValidFrameDuration(frame_duration_ms_)) {
+            frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+        }
+    }
     // For ML307 boards, we use complexity 5 to save bandwidth
     // For other boards, we use complexity 3 to save CPU
+    // The controller may lower it at runtime if encoding falls behind
     if (board.GetBoardType() == "ml307") {
         ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
+        opus_controller_.Reset(5, frame_duration_ms_);
     } else {
         ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 3");
-        opus_encoder_->SetComplexity(3);
+        opus_controller_.Reset(3, frame_duration_ms_);
     }
+    CreateEncoder(frame_duration_ms_);
 
-    if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
-    }
+    input_conditioner_.Configure(codec->input_sample_rate(), codec->input_channels());
     codec->OnInputReady([this, codec]() {
         BaseType_t higher_priority_task_woken = pdFALSE;
         xEventGroupSetBitsFromISR(event_group_, AUDIO_INPUT_READY_EVENT, &higher_priority_task_woken);
         return higher_priority_task_woken == pdTRUE;
     });
     codec->OnOutputReady([this]() {
-        BaseType_t higher_priority_task_woken = pdFALSE;
-        xEventGroupSetBitsFromISR(event_group_, AUDIO_OUTPUT_READY_EVENT, &higher_priority_task_woken);
-        return higher_priority_task_woken == pdTRUE;
+        return audio_playback_.NotifyFromISR();
     });
+    audio_playback_.Start(codec);
     codec->Start();
 
     /* Start the main loop */
@@ -366,14 +475,15 @@ void Application::Start() {
 #else
     protocol_ = std::make_unique<MqttProtocol>();
 #endif
+    protocol_->SetFrameDuration(frame_duration_ms_);
     protocol_->OnNetworkError([this](const std::string& message) {
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
-    protocol_->OnIncomingAudio([this](std::vector<uint8_t>&& data) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (device_state_ == kDeviceStateSpeaking) {
-            audio_decode_queue_.emplace_back(std::move(data));
+    protocol_->OnIncomingAudio([this](AudioPacket&& packet) {
+        if (device_state_ == kDeviceStateSpeaking && !aborted_) {
+            packet.set_timestamp(esp_timer_get_time());
+            audio_playback_.PushPacket(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -382,9 +492,17 @@ void Application::Start() {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
-        SetDecodeSampleRate(protocol_->server_sample_rate());
+        audio_playback_.SetDecodeSampleRate(protocol_->server_sample_rate());
+        // The server may have picked another frame duration for this session
+        int frame_duration = protocol_->frame_duration();
+        if (frame_duration != encoder_frame_duration_ms_) {
+            ESP_LOGI(TAG, "Switching opus frame duration to %d ms", frame_duration);
+            background_task_->WaitForCompletion();
+            CreateEncoder(frame_duration);
+        }
+        audio_playback_.SetFrameDuration(frame_duration);
         auto& thing_manager = iot::ThingManager::GetInstance();
-        protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
+        protocol_->SendIotDescriptors(thing_manager.GetDescriptors(), thing_manager.GetDescriptorsHash());
         std::string states;
         if (thing_manager.GetStatesJson(states, false)) {
             protocol_->SendIotStates(states);
@@ -398,55 +516,20 @@ void Application::Start() {
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        background_task_->WaitForCompletion();
-                        if (keep_listening_) {
-                            protocol_->SendStartListening(kListeningModeAutoStop);
-                            SetDeviceState(kDeviceStateListening);
-                        } else {
-                            SetDeviceState(kDeviceStateIdle);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (text != NULL) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (text != NULL) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (emotion != NULL) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "iot") == 0) {
+    protocol_->OnIncomingMessage([this](const JsonMessage& message) {
+        return HandleChatMessage(message.GetString("type"), message.GetString("state"),
+            message.GetString("text"), message.GetString("emotion"));
+    });
+    protocol_->OnIncomingJson([this](const cJSON* root) {
+        auto get_string = [root](const char* key) -> const char* {
+            auto item = cJSON_GetObjectItem(root, key);
+            return cJSON_IsString(item) ? item->valuestring : nullptr;
+        };
+        auto type = get_string("type");
+        if (HandleChatMessage(type, get_string("state"), get_string("text"), get_string("emotion"))) {
+            return;
+        }
+        if (type != nullptr && strcmp(type, "iot") == 0) {
             auto commands = cJSON_GetObjectItem(root, "commands");
             if (commands != NULL) {
                 auto& thing_manager = iot::ThingManager::GetInstance();
@@ -473,16 +556,24 @@ void Application::Start() {
         vTaskDelete(NULL);
     }, "check_new_version", 4096 * 2, this, 2, nullptr);
 
+#if CONFIG_USE_AUDIO_PROCESSOR
+    processor_consumer_ = capture_fanout_.AddConsumer("audio_processor");
+#else
+    encoder_consumer_ = capture_fanout_.AddConsumer("encoder");
+#endif
+#if CONFIG_USE_WAKE_WORD_DETECT
+    wake_word_consumer_ = capture_fanout_.AddConsumer("wake_word");
+#endif
+
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_.Initialize(codec->input_channels(), codec->input_reference());
+    if (audio_processor_.aec_enabled()) {
+        ESP_LOGI(TAG, "Realtime chat enabled, the microphone stays open while speaking");
+        listening_mode_ = kListeningModeAlwaysOn;
+    }
     audio_processor_.OnOutput([this](std::vector<int16_t>&& data) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
-            });
-        });
+        // The AFE output is traced from the capture time of the last frame fed to it
+        EncodeAudio(std::move(data), processor_input_time_);
     });
     audio_processor_.OnVadStateChange([this](bool speaking) {
         if (device_state_ == kDeviceStateListening) {
@@ -500,22 +591,24 @@ void Application::Start() {
 #endif
 
 #if CONFIG_USE_WAKE_WORD_DETECT
-    wake_word_detect_.Initialize(codec->input_channels(), codec->input_reference());
+    wake_word_detect_.Initialize(codec->input_channels(), codec->input_reference(),
+        opus_controller_.settings().frame_duration_ms);
     wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
         Schedule([this, &wake_word]() {
             if (device_state_ == kDeviceStateIdle) {
                 SetDeviceState(kDeviceStateConnecting);
-                wake_word_detect_.EncodeWakeWordData();
-
-                if (!protocol_->OpenAudioChannel()) {
+                if (!ConnectAudioChannel()) {
                     wake_word_detect_.StartDetection();
                     return;
                 }
-                
+                // Packets must match the frame duration the server agreed to, not the one proposed
+                wake_word_detect_.EncodeWakeWordData(protocol_->frame_duration());
+
                 std::vector<uint8_t> opus;
                 // Encode and send the wake word data to the server
                 while (wake_word_detect_.GetWakeWordOpus(opus)) {
-                    protocol_->SendAudio(opus);
+                    // The capture time of the pre-roll is not tracked
+                    protocol_->SendAudio(opus, 0);
                 }
                 // Set the chat state to wake word detected
                 protocol_->SendWakeWordDetected(wake_word);
@@ -539,12 +632,141 @@ void Application::Start() {
 void Application::OnClockTimer() {
     clock_ticks_++;
 
+    // Disable the output if there is no audio data for a long time
+    auto codec = Board::GetInstance().GetAudioCodec();
+    if (device_state_ == kDeviceStateIdle && codec->output_enabled() &&
+        audio_playback_.idle_seconds() > AUDIO_OUTPUT_IDLE_SECONDS) {
+        Schedule([this, codec]() {
+            if (device_state_ == kDeviceStateIdle) {
+                codec->EnableOutput(false);
+            }
+        });
+    }
+
+#if CONFIG_AUDIO_CHANNEL_PREWARM
+    if (device_state_ == kDeviceStateIdle && protocol_ && protocol_->IsAudioChannelOpened()) {
+        channel_idle_open_seconds_++;
+        if (++channel_idle_seconds_ > CONFIG_AUDIO_CHANNEL_KEEP_ALIVE_SECONDS) {
+            channel_idle_seconds_ = 0;
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateIdle && !prewarming_) {
+                    ESP_LOGI(TAG, "Audio channel idle for %d seconds, closing", CONFIG_AUDIO_CHANNEL_KEEP_ALIVE_SECONDS);
+                    protocol_->CloseAudioChannel();
+                }
+            });
+        }
+    } else {
+        channel_idle_seconds_ = 0;
+    }
+#endif
+
+#if CONFIG_LINK_QUALITY_PROBE
+    if (clock_ticks_ % LINK_PROBE_INTERVAL_SECONDS == 0 && protocol_ && protocol_->IsAudioChannelOpened()) {
+        Schedule([this]() {
+            if (protocol_->IsAudioChannelOpened()) {
+                protocol_->SendPing();
+            }
+        });
+    }
+#endif
+
+#if CONFIG_OPUS_ADAPTIVE_ENCODER
+    if (protocol_ && protocol_->IsAudioChannelOpened()) {
+        Schedule([this]() {
+            // Deleted before an OTA upgrade
+            if (background_task_ == nullptr) {
+                return;
+            }
+            OpusControllerInput input;
+            input.encoder_frame_duration_ms = encoder_frame_duration_ms_;
+            input.encode_backlog = background_task_->size();
+            input.send_backlog = scheduler_.pending(kSchedulePriorityHigh);
+            auto link = protocol_->link_quality();
+            input.loss_percent = link.loss_percent;
+            input.rtt_ms = link.rtt_ms;
+            input.probes = link.probes;
+            if (!opus_controller_.Update(input)) {
+                return;
+            }
+            protocol_->SetFrameDuration(opus_controller_.settings().frame_duration_ms);
+#if CONFIG_USE_WAKE_WORD_DETECT
+            wake_word_detect_.SetFrameDuration(opus_controller_.settings().frame_duration_ms);
+#endif
+            // Picked up by the next EncodeFrame, a queued callback could be dropped under load
+            encoder_complexity_ = opus_controller_.settings().complexity;
+        });
+    }
+#endif
+
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
         // SystemInfo::PrintRealTimeStats(pdMS_TO_TICKS(1000));
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
         ESP_LOGI(TAG, "Free internal: %u minimal internal: %u", free_sram, min_free_sram);
+        auto& queue = audio_playback_.queue();
+        if (queue.overflow_count() > 0) {
+            ESP_LOGW(TAG, "Audio decode queue: capacity %zu high water %zu overflow %zu dropped %zu",
+                queue.capacity(), queue.high_water_mark(), queue.overflow_count(), queue.drop_count());
+        }
+        if (audio_playback_.underruns() > 0) {
+            ESP_LOGW(TAG, "Audio playback underruns: %lu", audio_playback_.underruns());
+        }
+        auto& high = scheduler_.stats(kSchedulePriorityHigh);
+        auto& normal = scheduler_.stats(kSchedulePriorityNormal);
+        ESP_LOGI(TAG, "Schedule latency: high %lu tasks avg %lu us max %lu us, normal %lu tasks avg %lu us max %lu us",
+            high.tasks, high.average_latency_us(), high.max_latency_us,
+            normal.tasks, normal.average_latency_us(), normal.max_latency_us);
+        if (background_task_ != nullptr && background_task_->dropped() > 0) {
+            ESP_LOGW(TAG, "Background task: capacity %zu high water %zu dropped %zu",
+                background_task_->capacity(), background_task_->high_water_mark(), background_task_->dropped());
+        }
+#if CONFIG_LINK_QUALITY_PROBE
+        if (protocol_) {
+            auto link = protocol_->link_quality();
+            if (link.probes > 0) {
+                ESP_LOGI(TAG, "Link: rtt %lu ms jitter %lu ms loss %lu%% (%lu/%lu pongs)",
+                    link.rtt_ms, link.rtt_jitter_ms, link.loss_percent, link.pongs, link.probes);
+            }
+        }
+#endif
+#if CONFIG_OPUS_ADAPTIVE_ENCODER
+        if (opus_controller_.decisions() > 0) {
+            ESP_LOGI(TAG, "Opus encoder: complexity %d, next frame duration %d ms, encode load %lu%%, %lu decisions",
+                opus_controller_.settings().complexity, opus_controller_.settings().frame_duration_ms,
+                opus_controller_.encode_load(), opus_controller_.decisions());
+        }
+#endif
+#if CONFIG_AUDIO_CHANNEL_PREWARM
+        ESP_LOGI(TAG, "Audio channel: prewarm %lu, hits %lu, misses %lu, open while idle %lu s",
+            prewarm_attempts_, channel_hits_, channel_misses_, channel_idle_open_seconds_);
+#endif
+#if CONFIG_USE_AUDIO_PROCESSOR
+        if (audio_processor_.aec_enabled()) {
+            ESP_LOGI(TAG, "AEC: cpu %d%% ERLE %.1f dB", audio_processor_.aec_cpu_load(), audio_processor_.aec_erle_db());
+            audio_processor_.ResetStats();
+        }
+#endif
+        for (int i = 0; i < capture_fanout_.consumer_count(); i++) {
+            auto stats = capture_fanout_.stats(i);
+            if (stats.dropped > 0) {
+                ESP_LOGW(TAG, "Capture consumer %s: %lu frames read, %lu dropped", stats.name, stats.frames, stats.dropped);
+            }
+        }
+        if (capture_fanout_.overruns() > 0) {
+            ESP_LOGW(TAG, "Capture fanout overruns: %lu", capture_fanout_.overruns());
+        }
+        auto& pool = AudioPacketPool::GetInstance();
+        if (pool.heap_fallbacks() > 0) {
+            ESP_LOGW(TAG, "Audio packet pool: %zu/%zu slabs in use, peak %zu, heap fallbacks %zu",
+                pool.in_use(), pool.slab_count(), pool.peak_in_use(), pool.heap_fallbacks());
+        }
+
+#if CONFIG_AUDIO_LATENCY_TRACE
+        if (clock_ticks_ % 60 == 0) {
+            LatencyTracer::GetInstance().Dump();
+        }
+#endif
 
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (ota_.HasServerTime()) {
@@ -561,11 +783,8 @@ void Application::OnClockTimer() {
     }
 }
 
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
-    }
+void Application::Schedule(std::function<void()> callback, SchedulePriority priority) {
+    scheduler_.Push(std::move(callback), priority);
     xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
 }
 
@@ -575,138 +794,133 @@ void Application::Schedule(std::function<void()> callback) {
 void Application::MainLoop() {
     while (true) {
         auto bits = xEventGroupWaitBits(event_group_,
-            SCHEDULE_EVENT | AUDIO_INPUT_READY_EVENT | AUDIO_OUTPUT_READY_EVENT,
+            SCHEDULE_EVENT | AUDIO_INPUT_READY_EVENT,
             pdTRUE, pdFALSE, portMAX_DELAY);
 
         if (bits & AUDIO_INPUT_READY_EVENT) {
             InputAudio();
         }
-        if (bits & AUDIO_OUTPUT_READY_EVENT) {
-            OutputAudio();
-        }
         if (bits & SCHEDULE_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            std::list<std::function<void()>> tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
-            }
+            scheduler_.RunPending();
         }
     }
 }
 
-void Application::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
-    last_output_time_ = std::chrono::steady_clock::now();
+void Application::CreateEncoder(int frame_duration_ms) {
+    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_duration_ms);
+    encoder_frame_duration_ms_ = frame_duration_ms;
+    encoder_complexity_ = opus_controller_.settings().complexity;
+    applied_complexity_ = encoder_complexity_;
+    opus_encoder_->SetComplexity(applied_complexity_);
 }
 
-void Application::OutputAudio() {
-    auto now = std::chrono::steady_clock::now();
-    auto codec = Board::GetInstance().GetAudioCodec();
-    const int max_silence_seconds = 10;
-
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
-        // Disable the output if there is no audio data for a long time
-        if (device_state_ == kDeviceStateIdle) {
-            auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
-            if (duration > max_silence_seconds) {
-                codec->EnableOutput(false);
-            }
-        }
-        return;
-    }
-
-    if (device_state_ == kDeviceStateListening) {
-        audio_decode_queue_.clear();
+void Application::SetFrameDuration(int frame_duration_ms) {
+    if (!Protocol::IsValidFrameDuration(frame_duration_ms)) {
+        ESP_LOGE(TAG, "Invalid frame duration: %d", frame_duration_ms);
         return;
     }
-
-    last_output_time_ = now;
-    auto opus = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
-
-    background_task_->Schedule([this, codec, opus = std::move(opus)]() mutable {
-        if (aborted_) {
-            return;
-        }
-
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(opus), pcm)) {
-            return;
-        }
-
-        // Resample if the sample rate is different
-        if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
+    Schedule([this, frame_duration_ms]() {
+        frame_duration_ms_ = frame_duration_ms;
+        Settings settings("audio", true);
+        settings.SetInt("frame_duration", frame_duration_ms_);
+        opus_controller_.SetFrameDuration(frame_duration_ms_);
+#if CONFIG_USE_WAKE_WORD_DETECT
+        wake_word_detect_.SetFrameDuration(opus_controller_.settings().frame_duration_ms);
+#endif
+        if (protocol_) {
+            protocol_->SetFrameDuration(opus_controller_.settings().frame_duration_ms);
         }
-        
-        codec->OutputData(pcm);
+        ESP_LOGI(TAG, "Frame duration set to %d ms, used from the next audio channel", frame_duration_ms_);
     });
 }
 
 void Application::InputAudio() {
     auto codec = Board::GetInstance().GetAudioCodec();
-    std::vector<int16_t> data;
-    if (!codec->InputData(data)) {
+    int64_t capture_time = codec->input_timestamp();
+    auto frame = capture_fanout_.BeginWrite();
+    if (frame == nullptr) {
+        // A consumer still holds the oldest frame, read to keep the I2S DMA flowing and drop it
+        codec->InputData(overrun_buffer_);
         return;
     }
-
-    if (codec->input_sample_rate() != 16000) {
-        if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
-        } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
-        }
+    if (!codec->InputData(frame->data)) {
+        return;
     }
+    LatencyTracer::GetInstance().Record(kLatencyInputRead, capture_time);
+
+    input_conditioner_.Process(frame->data);
+    frame->timestamp = capture_time;
 
 #if CONFIG_USE_WAKE_WORD_DETECT
-    if (wake_word_detect_.IsDetectionRunning()) {
-        wake_word_detect_.Feed(data);
-    }
+    capture_fanout_.SetActive(wake_word_consumer_, wake_word_detect_.IsDetectionRunning());
 #endif
 #if CONFIG_USE_AUDIO_PROCESSOR
-    if (audio_processor_.IsRunning()) {
-        audio_processor_.Input(data);
-    }
+    capture_fanout_.SetActive(processor_consumer_, audio_processor_.IsRunning());
 #else
-    if (device_state_ == kDeviceStateListening) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
+    capture_fanout_.SetActive(encoder_consumer_, device_state_ == kDeviceStateListening);
+#endif
+    capture_fanout_.EndWrite();
+
+#if CONFIG_USE_WAKE_WORD_DETECT
+    capture_fanout_.Consume(wake_word_consumer_, [this](const CaptureFrame& frame) {
+        wake_word_detect_.Feed(frame.data);
+    });
+#endif
+#if CONFIG_USE_AUDIO_PROCESSOR
+    capture_fanout_.Consume(processor_consumer_, [this](const CaptureFrame& frame) {
+        processor_input_time_ = frame.timestamp;
+        audio_processor_.Input(frame.data);
+    });
+#else
+    if (device_state_ == kDeviceStateListening && !encoder_wakeup_pending_.exchange(true)) {
+        // The encoder reads the shared frames from the background task, one wake up drains them all
+        background_task_->Schedule([this]() {
+            encoder_wakeup_pending_ = false;
+            // The encoder takes ownership of its input, so hand it the frame's samples instead of a copy
+            // unless the wake word detector still has to read them
+            capture_fanout_.ConsumeOrTake(encoder_consumer_, [this](CaptureFrame& frame, bool last_reader) {
+                if (last_reader) {
+                    EncodeFrame(std::move(frame.data), frame.timestamp);
+                } else {
+                    EncodeFrame(std::vector<int16_t>(frame.data), frame.timestamp);
+                }
             });
         });
     }
 #endif
 }
 
+void Application::EncodeAudio(std::vector<int16_t>&& data, int64_t capture_time) {
+    background_task_->Schedule([this, data = std::move(data), capture_time]() mutable {
+        EncodeFrame(std::move(data), capture_time);
+    }, true);
+}
+
+void Application::EncodeFrame(std::vector<int16_t>&& data, int64_t capture_time) {
+    int complexity = encoder_complexity_.load(std::memory_order_relaxed);
+    if (complexity != applied_complexity_) {
+        applied_complexity_ = complexity;
+        opus_encoder_->SetComplexity(complexity);
+    }
+    auto& tracer = LatencyTracer::GetInstance();
+    tracer.Record(kLatencyInputEncodeStart, capture_time);
+    int64_t start_time = esp_timer_get_time();
+    uint32_t frames = 0;
+    opus_encoder_->Encode(std::move(data), [this, &tracer, &frames, capture_time](std::vector<uint8_t>&& opus) {
+        frames++;
+        tracer.Record(kLatencyInputEncoded, capture_time);
+        Schedule([this, opus = std::move(opus), capture_time]() {
+            protocol_->SendAudio(opus, (uint32_t)(capture_time / 1000));
+            LatencyTracer::GetInstance().Record(kLatencyInputSent, capture_time);
+        }, kSchedulePriorityHigh);
+    });
+    opus_controller_.RecordEncode(esp_timer_get_time() - start_time, frames);
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+    audio_playback_.Reset();
     protocol_->SendAbortSpeaking(reason);
 }
 
@@ -747,7 +961,7 @@ void Application::SetDeviceState(DeviceState state) {
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
-            ResetDecoder();
+            audio_playback_.Reset();
             opus_encoder_->ResetState();
 #if CONFIG_USE_AUDIO_PROCESSOR
             audio_processor_.Start();
@@ -763,14 +977,16 @@ void Application::SetDeviceState(DeviceState state) {
             break;
         case kDeviceStateSpeaking:
             display->SetStatus(Lang::Strings::SPEAKING);
-            ResetDecoder();
+            audio_playback_.Reset();
             codec->EnableOutput(true);
+            if (listening_mode_ != kListeningModeAlwaysOn) {
 #if CONFIG_USE_AUDIO_PROCESSOR
-            audio_processor_.Stop();
+                audio_processor_.Stop();
 #endif
 #if CONFIG_USE_WAKE_WORD_DETECT
-            wake_word_detect_.StartDetection();
+                wake_word_detect_.StartDetection();
 #endif
+            }
             break;
         default:
             // Do nothing
@@ -778,22 +994,6 @@ void Application::SetDeviceState(DeviceState state) {
     }
 }
 
-void Application::SetDecodeSampleRate(int sample_rate) {
-    if (opus_decode_sample_rate_ == sample_rate) {
-        return;
-    }
-
-    opus_decode_sample_rate_ = sample_rate;
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
-
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decode_sample_rate_, codec->output_sample_rate());
-        output_resampler_.Configure(opus_decode_sample_rate_, codec->output_sample_rate());
-    }
-}
-
 void Application::UpdateIotStates() {
     auto& thing_manager = iot::ThingManager::GetInstance();
     std::string states;
@@ -9,14 +9,18 @@
 #include <string>
 #include <mutex>
 #include <list>
+#include <atomic>
 
 #include <opus_encoder.h>
-#include <opus_decoder.h>
-#include <opus_resampler.h>
 
 #include "protocol.h"
 #include "ota.h"
 #include "background_task.h"
+#include "scheduler.h"
+#include "audio_playback.h"
+#include "audio_input_conditioner.h"
+#include "capture_fanout.h"
+#include "opus_controller.h"
 
 #if CONFIG_USE_WAKE_WORD_DETECT
 #include "wake_word_detect.h"
@@ -27,7 +31,10 @@
 
 #define SCHEDULE_EVENT (1 << 0)
 #define AUDIO_INPUT_READY_EVENT (1 << 1)
-#define AUDIO_OUTPUT_READY_EVENT (1 << 2)
+// Set while no prewarm is connecting
+#define PREWARM_IDLE_EVENT (1 << 2)
+// Connect plus the 10 second hello timeout of the transports
+#define PREWARM_WAIT_TIMEOUT_MS 15000
 
 enum DeviceState {
     kDeviceStateUnknown,
@@ -42,7 +49,7 @@ enum DeviceState {
     kDeviceStateFatalError
 };
 
-#define OPUS_FRAME_DURATION_MS 60
+#define AUDIO_OUTPUT_IDLE_SECONDS 10
 
 class Application {
 public:
@@ -57,7 +64,7 @@ public:
     void Start();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    void Schedule(std::function<void()> callback, SchedulePriority priority = kSchedulePriorityNormal);
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -69,6 +76,11 @@ public:
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
     void PlaySound(const std::string_view& sound);
+    // Early hint that a conversation may start, e.g. a button is pressed down
+    void PrewarmAudioChannel();
+    // Saved to the settings and proposed to the server when the next audio channel opens
+    void SetFrameDuration(int frame_duration_ms);
+    int GetFrameDuration() const { return frame_duration_ms_; }
     bool CanEnterSleepMode();
 
 private:
@@ -82,35 +94,61 @@ private:
     AudioProcessor audio_processor_;
 #endif
     Ota ota_;
-    std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    Scheduler scheduler_;
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
     volatile DeviceState device_state_ = kDeviceStateUnknown;
     bool keep_listening_ = false;
+    // Always on when the AEC lets the microphone stay open while speaking
+    ListeningMode listening_mode_ = kListeningModeAutoStop;
     bool aborted_ = false;
     bool voice_detected_ = false;
     int clock_ticks_ = 0;
 
-    // Audio encode / decode
+    // Audio channel opened ahead of a conversation or kept after one
+    std::atomic<bool> prewarming_{false};
+    // Opened by a prewarm, the opened callback has not run on the main loop yet
+    std::atomic<bool> prewarm_opened_pending_{false};
+    int channel_idle_seconds_ = 0;
+    uint32_t prewarm_attempts_ = 0;
+    uint32_t channel_hits_ = 0;
+    uint32_t channel_misses_ = 0;
+    uint32_t channel_idle_open_seconds_ = 0;
+
+    // Audio encode, the decoder lives in the playback task
     BackgroundTask* background_task_ = nullptr;
-    std::chrono::steady_clock::time_point last_output_time_;
-    std::list<std::vector<uint8_t>> audio_decode_queue_;
+    AudioPlayback audio_playback_{OPUS_FRAME_DURATION_MS};
 
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
-
-    int opus_decode_sample_rate_ = -1;
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    // Requested from the server, the encoder follows what the server agreed to
+    int frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+    int encoder_frame_duration_ms_ = 0;
+    OpusController opus_controller_;
+    // Set by the main loop, applied by the encoder task before its next frame
+    std::atomic<int> encoder_complexity_{0};
+    int applied_complexity_ = 0;
+    AudioInputConditioner input_conditioner_;
+    // Capture time of the last frame fed to the audio processor, for latency tracing
+    std::atomic<int64_t> processor_input_time_{0};
+    // Every captured frame is read and conditioned once, then shared by its consumers
+    CaptureFanout capture_fanout_;
+    int wake_word_consumer_ = -1;
+    int processor_consumer_ = -1;
+    int encoder_consumer_ = -1;
+    // Capture frames dropped while the ring is pinned are read into this
+    std::vector<int16_t> overrun_buffer_;
+    std::atomic<bool> encoder_wakeup_pending_{false};
 
     void MainLoop();
     void InputAudio();
-    void OutputAudio();
-    void ResetDecoder();
-    void SetDecodeSampleRate(int sample_rate);
+    void EncodeAudio(std::vector<int16_t>&& data, int64_t capture_time);
+    void EncodeFrame(std::vector<int16_t>&& data, int64_t capture_time);
+    void CreateEncoder(int frame_duration_ms);
+    bool ConnectAudioChannel();
+    void CompletePrewarm();
+    // Messages that need no more than flat string fields, returns false for other types
+    bool HandleChatMessage(const char* type, const char* state, const char* text, const char* emotion);
     void CheckNewVersion();
     void ShowActivationCode();
     void OnClockTimer();
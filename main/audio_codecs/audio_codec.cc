@@ -3,6 +3,7 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <cstring>
 #include <driver/i2s_common.h>
 
@@ -48,6 +49,7 @@ IRAM_ATTR bool AudioCodec::on_sent(i2s_chan_handle_t handle, i2s_event_data_t *e
 
 IRAM_ATTR bool AudioCodec::on_recv(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx) {
     auto audio_codec = (AudioCodec*)user_ctx;
+    audio_codec->input_timestamp_ = esp_timer_get_time();
     if (audio_codec->input_enabled_ && audio_codec->on_input_ready_) {
         return audio_codec->on_input_ready_();
     }
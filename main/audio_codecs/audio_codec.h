@@ -33,6 +33,9 @@ public:
     inline int input_channels() const { return input_channels_; }
     inline int output_channels() const { return output_channels_; }
     inline int output_volume() const { return output_volume_; }
+    inline bool output_enabled() const { return output_enabled_; }
+    // Time of the last I2S receive callback, in microseconds
+    inline int64_t input_timestamp() const { return input_timestamp_; }
 
 private:
     std::function<bool()> on_input_ready_;
@@ -54,6 +57,7 @@ protected:
     int input_channels_ = 1;
     int output_channels_ = 1;
     int output_volume_ = 70;
+    volatile int64_t input_timestamp_ = 0;
 
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
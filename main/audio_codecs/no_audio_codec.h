@@ -8,8 +8,17 @@
 
 class NoAudioCodec : public AudioCodec {
 private:
+    // Scratch buffers for the 32-bit I2S slots, kept in internal RAM and grown on demand
+    int32_t* read_buffer_ = nullptr;
+    int32_t* write_buffer_ = nullptr;
+    int read_buffer_samples_ = 0;
+    int write_buffer_samples_ = 0;
+    int gain_volume_ = -1;
+    int32_t gain_ = 0;
+
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
+    int32_t* ReserveBuffer(int32_t*& buffer, int& capacity, int samples);
 
 public:
     virtual ~NoAudioCodec();
@@ -0,0 +1,56 @@
+#ifndef _SAMPLE_FORMAT_H
+#define _SAMPLE_FORMAT_H
+
+#include <cstdint>
+
+// Sample format kernels used on every I2S frame. The loops are unrolled by four and
+// kept free of 64-bit math and branches, so GCC emits MULL / CLAMPS on Xtensa.
+
+// Q16 gain, 0..65536
+static inline int32_t VolumeToGain(int volume) {
+    if (volume <= 0) {
+        return 0;
+    }
+    if (volume >= 100) {
+        return 65536;
+    }
+    // Same curve as pow(volume / 100.0, 2) * 65536
+    return volume * volume * 65536 / 10000;
+}
+
+// int16 -> left aligned int32 with gain. |sample * gain| <= 32768 * 65536,
+// so the product always fits in int32 and needs no saturation.
+static inline void ScaleInt16ToInt32(const int16_t* src, int32_t* dst, int samples, int32_t gain) {
+    int i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        dst[i] = src[i] * gain;
+        dst[i + 1] = src[i + 1] * gain;
+        dst[i + 2] = src[i + 2] * gain;
+        dst[i + 3] = src[i + 3] * gain;
+    }
+    for (; i < samples; i++) {
+        dst[i] = src[i] * gain;
+    }
+}
+
+static inline int16_t SaturateInt16(int32_t value) {
+    value = value > INT16_MAX ? INT16_MAX : value;
+    value = value < -INT16_MAX ? -INT16_MAX : value;
+    return (int16_t)value;
+}
+
+// int32 -> int16 with an arithmetic right shift and saturation
+static inline void ShiftInt32ToInt16(const int32_t* src, int16_t* dst, int samples, int shift) {
+    int i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        dst[i] = SaturateInt16(src[i] >> shift);
+        dst[i + 1] = SaturateInt16(src[i + 1] >> shift);
+        dst[i + 2] = SaturateInt16(src[i + 2] >> shift);
+        dst[i + 3] = SaturateInt16(src[i + 3] >> shift);
+    }
+    for (; i < samples; i++) {
+        dst[i] = SaturateInt16(src[i] >> shift);
+    }
+}
+
+#endif // _SAMPLE_FORMAT_H
@@ -0,0 +1,93 @@
+#include "audio_input_conditioner.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstring>
+
+#define TAG "AudioInputConditioner"
+
+void AudioInputConditioner::Configure(int input_sample_rate, int channels, int output_sample_rate) {
+    channels_ = channels;
+    resampling_ = input_sample_rate != output_sample_rate;
+    if (!resampling_) {
+        return;
+    }
+
+    mic_resampler_.Configure(input_sample_rate, output_sample_rate);
+    if (channels_ == 2) {
+        reference_resampler_.Configure(input_sample_rate, output_sample_rate);
+    }
+
+    // Reserve for a 30ms frame up front, so the first frames do not allocate either
+    size_t input_samples = input_sample_rate / 1000 * 30;
+    size_t output_samples = mic_resampler_.GetOutputSamples(input_samples);
+    mic_input_.reserve(input_samples);
+    mic_output_.reserve(output_samples);
+    if (channels_ == 2) {
+        reference_input_.reserve(input_samples);
+        reference_output_.reserve(output_samples);
+    }
+    ESP_LOGI(TAG, "Resampling input from %d to %d, %d channels", input_sample_rate, output_sample_rate, channels_);
+}
+
+void AudioInputConditioner::Process(std::vector<int16_t>& data) {
+    if (!resampling_) {
+        return;
+    }
+
+    auto start_time = esp_timer_get_time();
+    if (channels_ == 2) {
+        ProcessStereo(data);
+    } else {
+        ProcessMono(data);
+    }
+
+    uint32_t elapsed = esp_timer_get_time() - start_time;
+    total_us_ += elapsed;
+    if (elapsed > max_us_) {
+        max_us_ = elapsed;
+    }
+    if (++frames_ % 1000 == 0) {
+        ESP_LOGD(TAG, "Processed %lu frames, average %lu us, max %lu us", frames_, average_us(), max_us_);
+    }
+}
+
+void AudioInputConditioner::ProcessStereo(std::vector<int16_t>& data) {
+    size_t samples = data.size() / 2;
+    mic_input_.resize(samples);
+    reference_input_.resize(samples);
+
+    const int16_t* src = data.data();
+    int16_t* mic = mic_input_.data();
+    int16_t* reference = reference_input_.data();
+    for (size_t i = 0; i < samples; ++i) {
+        mic[i] = src[0];
+        reference[i] = src[1];
+        src += 2;
+    }
+
+    size_t output_samples = mic_resampler_.GetOutputSamples(samples);
+    mic_output_.resize(output_samples);
+    reference_output_.resize(output_samples);
+    mic_resampler_.Process(mic, samples, mic_output_.data());
+    reference_resampler_.Process(reference, samples, reference_output_.data());
+
+    // Downsampling never grows the frame, so this normally reuses the capture buffer
+    data.resize(output_samples * 2);
+    int16_t* dst = data.data();
+    mic = mic_output_.data();
+    reference = reference_output_.data();
+    for (size_t i = 0; i < output_samples; ++i) {
+        dst[0] = mic[i];
+        dst[1] = reference[i];
+        dst += 2;
+    }
+}
+
+void AudioInputConditioner::ProcessMono(std::vector<int16_t>& data) {
+    size_t output_samples = mic_resampler_.GetOutputSamples(data.size());
+    mic_output_.resize(output_samples);
+    mic_resampler_.Process(data.data(), data.size(), mic_output_.data());
+    data.resize(output_samples);
+    memcpy(data.data(), mic_output_.data(), output_samples * sizeof(int16_t));
+}
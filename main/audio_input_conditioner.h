@@ -0,0 +1,42 @@
+#ifndef AUDIO_INPUT_CONDITIONER_H
+#define AUDIO_INPUT_CONDITIONER_H
+
+#include <opus_resampler.h>
+
+#include <vector>
+#include <cstdint>
+
+// Converts captured frames to the 16kHz layout expected by AFE and the encoder.
+// For stereo (mic + reference) input the deinterleave, the two resamplers and the
+// reinterleave run back to back over persistent scratch buffers, so no memory is
+// allocated per frame once the first frame has been processed.
+class AudioInputConditioner {
+public:
+    void Configure(int input_sample_rate, int channels, int output_sample_rate = 16000);
+    void Process(std::vector<int16_t>& data);
+
+    inline bool resampling() const { return resampling_; }
+    inline uint32_t frames() const { return frames_; }
+    inline uint32_t average_us() const { return frames_ > 0 ? total_us_ / frames_ : 0; }
+    inline uint32_t max_us() const { return max_us_; }
+
+private:
+    OpusResampler mic_resampler_;
+    OpusResampler reference_resampler_;
+    int channels_ = 1;
+    bool resampling_ = false;
+
+    std::vector<int16_t> mic_input_;
+    std::vector<int16_t> reference_input_;
+    std::vector<int16_t> mic_output_;
+    std::vector<int16_t> reference_output_;
+
+    uint32_t frames_ = 0;
+    uint64_t total_us_ = 0;
+    uint32_t max_us_ = 0;
+
+    void ProcessStereo(std::vector<int16_t>& data);
+    void ProcessMono(std::vector<int16_t>& data);
+};
+
+#endif // AUDIO_INPUT_CONDITIONER_H
@@ -0,0 +1,180 @@
+#include "audio_packet_pool.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <new>
+
+#define TAG "AudioPacketPool"
+
+#if CONFIG_AUDIO_PACKET_POOL_IN_PSRAM
+#define AUDIO_PACKET_POOL_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define AUDIO_PACKET_POOL_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#endif
+
+static inline size_t SlabStride(size_t slab_size) {
+    return (sizeof(AudioPacketBuffer) + slab_size + 3) & ~size_t(3);
+}
+
+AudioPacket AudioPacket::Borrow(const uint8_t* data, size_t size) {
+    AudioPacket packet;
+    packet.data_ = const_cast<uint8_t*>(data);
+    packet.size_ = size;
+    return packet;
+}
+
+AudioPacket::AudioPacket(const AudioPacket& other)
+    : buffer_(other.buffer_), data_(other.data_), size_(other.size_), sequence_(other.sequence_), timestamp_(other.timestamp_) {
+    if (buffer_ != nullptr) {
+        buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+AudioPacket::AudioPacket(AudioPacket&& other) noexcept
+    : buffer_(other.buffer_), data_(other.data_), size_(other.size_), sequence_(other.sequence_), timestamp_(other.timestamp_) {
+    other.buffer_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+AudioPacket& AudioPacket::operator=(const AudioPacket& other) {
+    if (this != &other) {
+        if (other.buffer_ != nullptr) {
+            other.buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        Release();
+        buffer_ = other.buffer_;
+        data_ = other.data_;
+        size_ = other.size_;
+        sequence_ = other.sequence_;
+        timestamp_ = other.timestamp_;
+    }
+    return *this;
+}
+
+AudioPacket& AudioPacket::operator=(AudioPacket&& other) noexcept {
+    if (this != &other) {
+        Release();
+        buffer_ = other.buffer_;
+        data_ = other.data_;
+        size_ = other.size_;
+        sequence_ = other.sequence_;
+        timestamp_ = other.timestamp_;
+        other.buffer_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+AudioPacket::~AudioPacket() {
+    Release();
+}
+
+void AudioPacket::Resize(size_t size) {
+    if (size > capacity()) {
+        ESP_LOGE(TAG, "Packet size %zu exceeds capacity %zu", size, capacity());
+        size = capacity();
+    }
+    size_ = size;
+}
+
+void AudioPacket::Release() {
+    if (buffer_ == nullptr) {
+        data_ = nullptr;
+        size_ = 0;
+        sequence_ = 0;
+        timestamp_ = 0;
+        return;
+    }
+    if (buffer_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (buffer_->from_heap) {
+            buffer_->~AudioPacketBuffer();
+            heap_caps_free(buffer_);
+        } else {
+            AudioPacketPool::GetInstance().Free(buffer_);
+        }
+    }
+    buffer_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+    sequence_ = 0;
+    timestamp_ = 0;
+}
+
+AudioPacketPool::AudioPacketPool(size_t slab_size, size_t slab_count)
+    : slab_size_(slab_size), slab_count_(slab_count) {
+    auto stride = SlabStride(slab_size_);
+    slabs_ = (uint8_t*)heap_caps_malloc(stride * slab_count_, AUDIO_PACKET_POOL_CAPS);
+    if (slabs_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %zu slabs, packets will use the heap", slab_count_);
+        slab_count_ = 0;
+        return;
+    }
+
+    free_list_.reserve(slab_count_);
+    for (size_t i = 0; i < slab_count_; i++) {
+        auto buffer = new (slabs_ + i * stride) AudioPacketBuffer;
+        buffer->capacity = slab_size_;
+        buffer->from_heap = false;
+        free_list_.push_back(buffer);
+    }
+    ESP_LOGI(TAG, "Packet pool ready, %zu slabs of %zu bytes", slab_count_, slab_size_);
+}
+
+AudioPacketPool::~AudioPacketPool() {
+    if (slabs_ != nullptr) {
+        heap_caps_free(slabs_);
+    }
+}
+
+AudioPacket AudioPacketPool::Acquire(size_t size) {
+    AudioPacketBuffer* buffer = nullptr;
+    if (size <= slab_size_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_list_.empty()) {
+            buffer = free_list_.back();
+            free_list_.pop_back();
+        }
+    }
+
+    if (buffer != nullptr) {
+        auto in_use = in_use_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (in_use > peak_in_use_.load(std::memory_order_relaxed)) {
+            peak_in_use_.store(in_use, std::memory_order_relaxed);
+        }
+    } else {
+        // Pool exhausted or the packet is oversized
+        heap_fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        auto memory = heap_caps_malloc(sizeof(AudioPacketBuffer) + size, AUDIO_PACKET_POOL_CAPS);
+        if (memory == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate packet of %zu bytes", size);
+            return AudioPacket();
+        }
+        buffer = new (memory) AudioPacketBuffer;
+        buffer->capacity = size;
+        buffer->from_heap = true;
+    }
+
+    buffer->refs.store(1, std::memory_order_relaxed);
+    AudioPacket packet;
+    packet.buffer_ = buffer;
+    packet.data_ = buffer->data;
+    packet.size_ = size;
+    return packet;
+}
+
+AudioPacket AudioPacketPool::Copy(const void* data, size_t size) {
+    auto packet = Acquire(size);
+    if (!packet.empty()) {
+        memcpy(packet.data(), data, size);
+    }
+    return packet;
+}
+
+void AudioPacketPool::Free(AudioPacketBuffer* buffer) {
+    in_use_.fetch_sub(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_list_.push_back(buffer);
+}
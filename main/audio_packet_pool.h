@@ -0,0 +1,103 @@
+#ifndef AUDIO_PACKET_POOL_H
+#define AUDIO_PACKET_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Enough for a 60ms Opus frame at up to ~128kbps, bigger packets fall back to the heap
+#define AUDIO_PACKET_SLAB_SIZE 1024
+#if CONFIG_AUDIO_PACKET_POOL_IN_PSRAM
+#define AUDIO_PACKET_SLAB_COUNT 64
+#else
+#define AUDIO_PACKET_SLAB_COUNT 16
+#endif
+
+struct AudioPacketBuffer {
+    std::atomic<int> refs;
+    uint32_t capacity;
+    bool from_heap;
+    uint8_t data[];
+};
+
+// Reference counted handle to an Opus packet stored in a pool slab.
+// Copying a handle shares the buffer, so it can be captured by std::function
+// and moved through the decode queue without copying the payload.
+// A borrowed packet points to read-only memory such as a flash mapped asset.
+class AudioPacket {
+public:
+    static AudioPacket Borrow(const uint8_t* data, size_t size);
+
+    AudioPacket() = default;
+    AudioPacket(const AudioPacket& other);
+    AudioPacket(AudioPacket&& other) noexcept;
+    AudioPacket& operator=(const AudioPacket& other);
+    AudioPacket& operator=(AudioPacket&& other) noexcept;
+    ~AudioPacket();
+
+    inline uint8_t* data() { return data_; }
+    inline const uint8_t* data() const { return data_; }
+    inline size_t size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+    inline bool borrowed() const { return buffer_ == nullptr && data_ != nullptr; }
+    inline size_t capacity() const { return buffer_ ? buffer_->capacity : 0; }
+    void Resize(size_t size);
+
+    // Transport sequence number, 0 if the transport has none
+    inline uint32_t sequence() const { return sequence_; }
+    inline void set_sequence(uint32_t sequence) { sequence_ = sequence; }
+
+    // Arrival time in microseconds, 0 for local sounds
+    inline int64_t timestamp() const { return timestamp_; }
+    inline void set_timestamp(int64_t timestamp) { timestamp_ = timestamp; }
+
+private:
+    friend class AudioPacketPool;
+    AudioPacketBuffer* buffer_ = nullptr;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    uint32_t sequence_ = 0;
+    int64_t timestamp_ = 0;
+
+    void Release();
+};
+
+class AudioPacketPool {
+public:
+    static AudioPacketPool& GetInstance() {
+        static AudioPacketPool instance(AUDIO_PACKET_SLAB_SIZE, AUDIO_PACKET_SLAB_COUNT);
+        return instance;
+    }
+    AudioPacketPool(const AudioPacketPool&) = delete;
+    AudioPacketPool& operator=(const AudioPacketPool&) = delete;
+
+    // Returns an empty handle only if the heap is exhausted too
+    AudioPacket Acquire(size_t size);
+    AudioPacket Copy(const void* data, size_t size);
+
+    inline size_t slab_size() const { return slab_size_; }
+    inline size_t slab_count() const { return slab_count_; }
+    inline size_t in_use() const { return in_use_.load(std::memory_order_relaxed); }
+    inline size_t peak_in_use() const { return peak_in_use_.load(std::memory_order_relaxed); }
+    inline size_t heap_fallbacks() const { return heap_fallbacks_.load(std::memory_order_relaxed); }
+
+private:
+    AudioPacketPool(size_t slab_size, size_t slab_count);
+    ~AudioPacketPool();
+
+    friend class AudioPacket;
+    void Free(AudioPacketBuffer* buffer);
+
+    size_t slab_size_;
+    size_t slab_count_;
+    uint8_t* slabs_ = nullptr;
+    std::mutex mutex_;
+    std::vector<AudioPacketBuffer*> free_list_;
+    std::atomic<size_t> in_use_{0};
+    std::atomic<size_t> peak_in_use_{0};
+    std::atomic<size_t> heap_fallbacks_{0};
+};
+
+#endif // AUDIO_PACKET_POOL_H
@@ -0,0 +1,212 @@
+#include "audio_playback.h"
+#include "protocol.h"
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <arpa/inet.h>
+
+#define TAG "AudioPlayback"
+
+AudioPlayback::AudioPlayback(int frame_duration_ms)
+    : jitter_buffer_(frame_duration_ms), pcm_ring_(AUDIO_PLAYBACK_DECODE_AHEAD_FRAMES),
+      pcm_timestamps_(AUDIO_PLAYBACK_DECODE_AHEAD_FRAMES) {
+}
+
+AudioPlayback::~AudioPlayback() {
+    if (task_handle_ != nullptr) {
+        vTaskDelete(task_handle_);
+    }
+}
+
+void AudioPlayback::Start(AudioCodec* codec) {
+    codec_ = codec;
+    decode_sample_rate_ = codec_->output_sample_rate();
+    decoder_ = std::make_unique<OpusDecoderWrapper>(decode_sample_rate_, 1);
+    last_output_time_ = esp_timer_get_time();
+
+    xTaskCreate([](void* arg) {
+        AudioPlayback* playback = (AudioPlayback*)arg;
+        playback->PlaybackLoop();
+    }, "audio_playback", AUDIO_PLAYBACK_TASK_STACK_SIZE, this, 5, &task_handle_);
+}
+
+void AudioPlayback::PushPacket(AudioPacket&& packet) {
+    queue_.Push(std::move(packet));
+    xTaskNotifyGive(task_handle_);
+}
+
+void AudioPlayback::PlaySound(const std::string_view& sound) {
+    {
+        // The frames are read lazily by the playback task, nothing is copied here
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_sounds_.push_back(sound);
+    }
+    xTaskNotifyGive(task_handle_);
+}
+
+void AudioPlayback::SetDecodeSampleRate(int sample_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (decode_sample_rate_ == sample_rate) {
+        return;
+    }
+
+    decode_sample_rate_ = sample_rate;
+    decoder_.reset();
+    decoder_ = std::make_unique<OpusDecoderWrapper>(decode_sample_rate_, 1);
+
+    if (decode_sample_rate_ != codec_->output_sample_rate()) {
+        ESP_LOGI(TAG, "Resampling audio from %d to %d", decode_sample_rate_, codec_->output_sample_rate());
+        resampler_.Configure(decode_sample_rate_, codec_->output_sample_rate());
+    }
+}
+
+void AudioPlayback::SetFrameDuration(int frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jitter_buffer_.SetFrameDuration(frame_duration_ms);
+}
+
+void AudioPlayback::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    decoder_->ResetState();
+    // The playback task only consumes the queue while holding the mutex
+    queue_.Clear();
+    jitter_buffer_.Reset();
+    pending_sounds_.clear();
+    playing_sound_ = std::string_view();
+    pcm_head_ = 0;
+    pcm_count_ = 0;
+    playing_ = false;
+    starved_ = false;
+    last_output_time_ = esp_timer_get_time();
+    condition_variable_.notify_all();
+}
+
+void AudioPlayback::WaitForCompletion() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_variable_.wait(lock, [this]() {
+        return pcm_count_ == 0 && !writing_ && jitter_buffer_.buffered() == 0 && queue_.Empty();
+    });
+}
+
+bool AudioPlayback::NotifyFromISR() {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task_handle_, &higher_priority_task_woken);
+    return higher_priority_task_woken == pdTRUE;
+}
+
+int AudioPlayback::idle_seconds() const {
+    return (esp_timer_get_time() - last_output_time_) / 1000000;
+}
+
+void AudioPlayback::PlaybackLoop() {
+    ESP_LOGI(TAG, "Playback task started, decoding %d frames ahead", AUDIO_PLAYBACK_DECODE_AHEAD_FRAMES);
+    TickType_t timeout = portMAX_DELAY;
+    while (true) {
+        // Woken up by new packets, new sounds or the codec asking for more data
+        ulTaskNotifyTake(pdTRUE, timeout);
+
+        while (true) {
+            std::vector<int16_t>* frame = nullptr;
+            int64_t timestamp = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                writing_ = false;
+                while (pcm_count_ < pcm_ring_.size() && DecodeFrame()) {
+                }
+                if (pcm_count_ == 0) {
+                    // Frames held back for the playout delay need a wake up even if nothing else arrives
+                    timeout = jitter_buffer_.buffered() > 0 ? pdMS_TO_TICKS(10) : portMAX_DELAY;
+                    if (playing_) {
+                        playing_ = false;
+                        starved_ = true;
+                    }
+                    condition_variable_.notify_all();
+                    break;
+                }
+
+                if (starved_) {
+                    // The stream resumed after running dry without a reset in between
+                    starved_ = false;
+                    underruns_++;
+                }
+                frame = &pcm_ring_[pcm_head_];
+                timestamp = pcm_timestamps_[pcm_head_];
+                pcm_head_ = (pcm_head_ + 1) % pcm_ring_.size();
+                pcm_count_--;
+                playing_ = true;
+                writing_ = true;
+                last_output_time_ = esp_timer_get_time();
+            }
+
+            // The slot is only refilled by this task, after the write has returned
+            codec_->OutputData(*frame);
+            LatencyTracer::GetInstance().Record(kLatencyOutputWritten, timestamp);
+        }
+    }
+}
+
+// Decodes one frame into the tail of the PCM ring, called with the mutex held
+bool AudioPlayback::DecodeFrame() {
+    AudioPacket opus;
+    // Packets that do not fit yet stay in the queue, a burst must not look like a sequence jump
+    while (jitter_buffer_.HasRoom() && queue_.Pop(opus)) {
+        jitter_buffer_.Put(std::move(opus));
+    }
+    // A lost packet is left empty and decoded as packet loss concealment
+    if (jitter_buffer_.Get(opus) == kJitterBufferEmpty && !ReadSoundFrame(opus)) {
+        return false;
+    }
+
+    auto& tracer = LatencyTracer::GetInstance();
+    int64_t timestamp = opus.timestamp();
+    tracer.Record(kLatencyOutputDecodeStart, timestamp);
+
+    // Decode() only reads the buffer, so its capacity is kept for the next packet
+    decode_buffer_.assign(opus.data(), opus.data() + opus.size());
+    opus = AudioPacket();
+
+    size_t tail = (pcm_head_ + pcm_count_) % pcm_ring_.size();
+    auto& pcm = pcm_ring_[tail];
+    if (!decoder_->Decode(std::move(decode_buffer_), pcm)) {
+        // Skip the broken packet, but keep trying the next ones
+        return true;
+    }
+
+    // Resample if the sample rate is different
+    if (decode_sample_rate_ != codec_->output_sample_rate()) {
+        resample_buffer_.resize(resampler_.GetOutputSamples(pcm.size()));
+        resampler_.Process(pcm.data(), pcm.size(), resample_buffer_.data());
+        pcm.swap(resample_buffer_);
+    }
+    tracer.Record(kLatencyOutputDecoded, timestamp);
+    pcm_timestamps_[tail] = timestamp;
+    pcm_count_++;
+    return true;
+}
+
+bool AudioPlayback::ReadSoundFrame(AudioPacket& packet) {
+    if (playing_sound_.size() < sizeof(BinaryProtocol3)) {
+        if (pending_sounds_.empty()) {
+            playing_sound_ = std::string_view();
+            return false;
+        }
+        playing_sound_ = pending_sounds_.front();
+        pending_sounds_.pop_front();
+        if (playing_sound_.size() < sizeof(BinaryProtocol3)) {
+            return false;
+        }
+    }
+
+    auto p3 = (const BinaryProtocol3*)playing_sound_.data();
+    size_t payload_size = ntohs(p3->payload_size);
+    size_t frame_size = sizeof(BinaryProtocol3) + payload_size;
+    if (frame_size > playing_sound_.size()) {
+        ESP_LOGE(TAG, "Invalid P3 frame size: %zu", payload_size);
+        playing_sound_ = std::string_view();
+        return false;
+    }
+    packet = AudioPacket::Borrow(p3->payload, payload_size);
+    playing_sound_.remove_prefix(frame_size);
+    return true;
+}
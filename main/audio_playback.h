@@ -0,0 +1,96 @@
+#ifndef AUDIO_PLAYBACK_H
+#define AUDIO_PLAYBACK_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+#include <opus_decoder.h>
+#include <opus_resampler.h>
+
+#include "audio_codec.h"
+#include "audio_packet_pool.h"
+#include "spsc_queue.h"
+#include "jitter_buffer.h"
+
+// About 15 seconds of 60ms frames
+#define AUDIO_DECODE_QUEUE_CAPACITY 256
+#define AUDIO_PLAYBACK_TASK_STACK_SIZE (4096 * 6)
+
+#ifdef CONFIG_AUDIO_PLAYBACK_DECODE_AHEAD_FRAMES
+#define AUDIO_PLAYBACK_DECODE_AHEAD_FRAMES CONFIG_AUDIO_PLAYBACK_DECODE_AHEAD_FRAMES
+#else
+#define AUDIO_PLAYBACK_DECODE_AHEAD_FRAMES 2
+#endif
+
+// Decode and playback stage. A dedicated task owns the Opus decoder: it pulls packets
+// from the decode queue (or the local P3 prompts), keeps a few frames decoded ahead
+// in a PCM ring and writes them to the codec, so the encoder's BackgroundTask queue
+// is never shared with the speaker.
+class AudioPlayback {
+public:
+    AudioPlayback(int frame_duration_ms);
+    ~AudioPlayback();
+
+    void Start(AudioCodec* codec);
+    // Called from the protocol receive task, the only producer of the decode queue
+    void PushPacket(AudioPacket&& packet);
+    void PlaySound(const std::string_view& sound);
+    void SetDecodeSampleRate(int sample_rate);
+    void SetFrameDuration(int frame_duration_ms);
+    // Drops everything queued or decoded ahead and resets the decoder state
+    void Reset();
+    // Blocks until every queued packet, including those held by the jitter buffer, has been written to the codec
+    void WaitForCompletion();
+    // Wakes up the playback task when the codec can take more data, called from the I2S ISR
+    bool NotifyFromISR();
+
+    int idle_seconds() const;
+    inline uint32_t underruns() const { return underruns_; }
+    inline const SpscQueue<AudioPacket>& queue() const { return queue_; }
+
+private:
+    AudioCodec* codec_ = nullptr;
+    TaskHandle_t task_handle_ = nullptr;
+    // Guards everything below that the task touches while decoding, but never the codec write
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+
+    SpscQueue<AudioPacket> queue_{AUDIO_DECODE_QUEUE_CAPACITY};
+    JitterBuffer jitter_buffer_;
+    std::list<std::string_view> pending_sounds_;
+    std::string_view playing_sound_;
+
+    std::unique_ptr<OpusDecoderWrapper> decoder_;
+    OpusResampler resampler_;
+    int decode_sample_rate_ = -1;
+    std::vector<uint8_t> decode_buffer_;
+    std::vector<int16_t> resample_buffer_;
+
+    // Decoded frames waiting for the codec, reused in place
+    std::vector<std::vector<int16_t>> pcm_ring_;
+    // Arrival time of the packet behind each frame, for latency tracing
+    std::vector<int64_t> pcm_timestamps_;
+    size_t pcm_head_ = 0;
+    size_t pcm_count_ = 0;
+    bool writing_ = false;
+
+    bool playing_ = false;
+    bool starved_ = false;
+    uint32_t underruns_ = 0;
+    // Read by idle_seconds() from the clock timer without the lock
+    std::atomic<int64_t> last_output_time_{0};
+
+    void PlaybackLoop();
+    bool DecodeFrame();
+    bool ReadSoundFrame(AudioPacket& packet);
+};
+
+#endif // AUDIO_PLAYBACK_H
@@ -0,0 +1,63 @@
+#ifndef AFE_FEED_BUFFER_H
+#define AFE_FEED_BUFFER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// Cuts the captured frames into the fixed chunks expected by afe->feed().
+// Whole chunks are fed straight from the caller's data, only the bytes that
+// straddle two frames are copied into a buffer of exactly one chunk, so
+// nothing is moved or reallocated once Initialize() has run.
+class AfeFeedBuffer {
+public:
+    // chunk_samples = feed chunk size * channels
+    void Initialize(size_t chunk_samples) {
+        chunk_.assign(chunk_samples, 0);
+        filled_ = 0;
+    }
+
+    void Clear() {
+        filled_ = 0;
+    }
+
+    template <typename Feed>
+    void Append(const int16_t* data, size_t samples, Feed&& feed) {
+        const size_t chunk_samples = chunk_.size();
+        if (chunk_samples == 0) {
+            return;
+        }
+        if (filled_ > 0) {
+            size_t count = chunk_samples - filled_;
+            if (count > samples) {
+                count = samples;
+            }
+            memcpy(chunk_.data() + filled_, data, count * sizeof(int16_t));
+            filled_ += count;
+            data += count;
+            samples -= count;
+            if (filled_ < chunk_samples) {
+                return;
+            }
+            feed(chunk_.data());
+            filled_ = 0;
+        }
+
+        while (samples >= chunk_samples) {
+            feed(data);
+            data += chunk_samples;
+            samples -= chunk_samples;
+        }
+
+        if (samples > 0) {
+            memcpy(chunk_.data(), data, samples * sizeof(int16_t));
+            filled_ = samples;
+        }
+    }
+
+private:
+    std::vector<int16_t> chunk_;
+    size_t filled_ = 0;
+};
+
+#endif // AFE_FEED_BUFFER_H
@@ -1,7 +1,11 @@
 #include "audio_processor.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <cmath>
 
 #define PROCESSOR_RUNNING 0x01
+// Reference amplitude above which the speaker is considered to be playing, about -50 dBFS
+#define FAR_END_THRESHOLD 100
 
 static const char* TAG = "AudioProcessor";
 
@@ -24,7 +28,11 @@ void AudioProcessor::Initialize(int channels, bool reference) {
     }
 
     afe_config_t* afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
-    afe_config->aec_init = false;
+#if CONFIG_USE_REALTIME_CHAT
+    // The echo can only be cancelled with the speaker signal looped back
+    aec_enabled_ = reference_;
+#endif
+    afe_config->aec_init = aec_enabled_;
     afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
     afe_config->ns_init = true;
     afe_config->vad_init = true;
@@ -39,6 +47,7 @@ void AudioProcessor::Initialize(int channels, bool reference) {
 
     afe_iface_ = esp_afe_handle_from_config(afe_config);
     afe_data_ = afe_iface_->create_from_config(afe_config);
+    feed_buffer_.Initialize(afe_iface_->get_feed_chunksize(afe_data_) * channels_);
     
     xTaskCreate([](void* arg) {
         auto this_ = (AudioProcessor*)arg;
@@ -55,14 +64,74 @@ AudioProcessor::~AudioProcessor() {
 }
 
 void AudioProcessor::Input(const std::vector<int16_t>& data) {
-    input_buffer_.insert(input_buffer_.end(), data.begin(), data.end());
+    if (!aec_enabled_) {
+        feed_buffer_.Append(data.data(), data.size(), [this](const int16_t* chunk) {
+            afe_iface_->feed(afe_data_, chunk);
+        });
+        return;
+    }
 
-    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_) * channels_;
-    while (input_buffer_.size() >= feed_size) {
-        auto chunk = input_buffer_.data();
+    const size_t chunk_samples = afe_iface_->get_feed_chunksize(afe_data_) * channels_;
+    feed_buffer_.Append(data.data(), data.size(), [this, chunk_samples](const int16_t* chunk) {
+        MeasureFeed(chunk, chunk_samples);
+        auto start_time = esp_timer_get_time();
         afe_iface_->feed(afe_data_, chunk);
-        input_buffer_.erase(input_buffer_.begin(), input_buffer_.begin() + feed_size);
+        feed_time_us_ += esp_timer_get_time() - start_time;
+    });
+}
+
+void AudioProcessor::MeasureFeed(const int16_t* chunk, size_t samples) {
+    // The first channel is a microphone, the last one is the speaker reference
+    uint64_t mic_energy = 0;
+    uint64_t ref_energy = 0;
+    size_t frames = samples / channels_;
+    for (size_t i = 0; i < samples; i += channels_) {
+        int32_t mic = chunk[i];
+        int32_t ref = chunk[i + channels_ - 1];
+        mic_energy += mic * mic;
+        ref_energy += ref * ref;
+    }
+    fed_samples_ += frames;
+
+    bool far_end = ref_energy > (uint64_t)FAR_END_THRESHOLD * FAR_END_THRESHOLD * frames;
+    far_end_active_ = far_end;
+    // ERLE is only meaningful while the speaker plays and nobody talks
+    if (far_end && !is_speaking_) {
+        echo_input_energy_ += mic_energy;
+        echo_input_samples_ += frames;
+    }
+}
+
+int AudioProcessor::aec_cpu_load() const {
+    uint64_t samples = fed_samples_;
+    if (samples == 0) {
+        return 0;
+    }
+    // Audio is 16kHz, so 16 samples last 1ms
+    return feed_time_us_ * 100 / (samples * 1000 / 16);
+}
+
+float AudioProcessor::aec_erle_db() const {
+    uint32_t input_samples = echo_input_samples_;
+    uint32_t output_samples = echo_output_samples_;
+    if (input_samples == 0 || output_samples == 0) {
+        return 0;
     }
+    double input_power = (double)echo_input_energy_ / input_samples;
+    double output_power = (double)echo_output_energy_ / output_samples;
+    if (output_power < 1) {
+        output_power = 1;
+    }
+    return 10 * log10(input_power / output_power);
+}
+
+void AudioProcessor::ResetStats() {
+    feed_time_us_ = 0;
+    fed_samples_ = 0;
+    echo_input_energy_ = 0;
+    echo_input_samples_ = 0;
+    echo_output_energy_ = 0;
+    echo_output_samples_ = 0;
 }
 
 void AudioProcessor::Start() {
@@ -117,6 +186,17 @@ void AudioProcessor::AudioProcessorTask() {
             }
         }
 
+        if (aec_enabled_ && far_end_active_ && !is_speaking_) {
+            auto data = (const int16_t*)res->data;
+            size_t samples = res->data_size / sizeof(int16_t);
+            uint64_t energy = 0;
+            for (size_t i = 0; i < samples; i++) {
+                energy += (int32_t)data[i] * data[i];
+            }
+            echo_output_energy_ += energy;
+            echo_output_samples_ += samples;
+        }
+
         if (output_callback_) {
             output_callback_(std::vector<int16_t>(res->data, res->data + res->data_size / sizeof(int16_t)));
         }
@@ -9,6 +9,9 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
+
+#include "afe_feed_buffer.h"
 
 class AudioProcessor {
 public:
@@ -23,16 +26,36 @@ public:
     void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback);
     void OnVadStateChange(std::function<void(bool speaking)> callback);
 
+    // AEC statistics since the last ResetStats(), only collected when AEC is enabled
+    // Percent of one core spent in afe->feed(), where the AEC runs
+    int aec_cpu_load() const;
+    // Echo return loss enhancement while only the speaker is playing, 0 if not measured yet
+    float aec_erle_db() const;
+    void ResetStats();
+    bool aec_enabled() const { return aec_enabled_; }
+
 private:
     EventGroupHandle_t event_group_ = nullptr;
     esp_afe_sr_iface_t* afe_iface_ = nullptr;
     esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::vector<int16_t> input_buffer_;
+    AfeFeedBuffer feed_buffer_;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     int channels_;
     bool reference_;
     bool is_speaking_ = false;
+    bool aec_enabled_ = false;
+
+    // Written by the feeding thread and the processor task, read from the clock timer
+    std::atomic<uint64_t> feed_time_us_{0};
+    std::atomic<uint64_t> fed_samples_{0};
+    std::atomic<bool> far_end_active_{false};
+    std::atomic<uint64_t> echo_input_energy_{0};
+    std::atomic<uint32_t> echo_input_samples_{0};
+    std::atomic<uint64_t> echo_output_energy_{0};
+    std::atomic<uint32_t> echo_output_samples_{0};
+
+    void MeasureFeed(const int16_t* chunk, size_t samples);
 
     void AudioProcessorTask();
 };
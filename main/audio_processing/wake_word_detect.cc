@@ -5,8 +5,10 @@
 #include <model_path.h>
 #include <arpa/inet.h>
 #include <sstream>
+#include <algorithm>
 
 #define DETECTION_RUNNING_EVENT 1
+#define PREROLL_REENCODE_EVENT 2
 
 static const char* TAG = "WakeWordDetect";
 
@@ -26,11 +28,16 @@ WakeWordDetect::~WakeWordDetect() {
     if (wake_word_encode_task_stack_ != nullptr) {
         heap_caps_free(wake_word_encode_task_stack_);
     }
+#if CONFIG_WAKE_WORD_PREROLL_ENCODE
+    if (preroll_pcm_ != nullptr) {
+        heap_caps_free(preroll_pcm_);
+    }
+#endif
 
     vEventGroupDelete(event_group_);
 }
 
-void WakeWordDetect::Initialize(int channels, bool reference) {
+void WakeWordDetect::Initialize(int channels, bool reference, int frame_duration_ms) {
     channels_ = channels;
     reference_ = reference;
     int ref_num = reference_ ? 1 : 0;
@@ -66,12 +73,24 @@ void WakeWordDetect::Initialize(int channels, bool reference) {
     
     afe_iface_ = esp_afe_handle_from_config(afe_config);
     afe_data_ = afe_iface_->create_from_config(afe_config);
-
+    feed_buffer_.Initialize(afe_iface_->get_feed_chunksize(afe_data_) * channels_);
+#if CONFIG_WAKE_WORD_PREROLL_ENCODE
+    CreatePrerollEncoder(frame_duration_ms);
+    preroll_pcm_ = (int16_t*)heap_caps_malloc(WAKE_WORD_PREROLL_SAMPLES * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    // Same as the encode task it replaces, the stack is too large for the internal RAM
+    wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(WAKE_WORD_DETECT_TASK_STACK_SIZE, MALLOC_CAP_SPIRAM);
+    xTaskCreateStatic([](void* arg) {
+        auto this_ = (WakeWordDetect*)arg;
+        this_->AudioDetectionTask();
+        vTaskDelete(NULL);
+    }, "audio_detection", WAKE_WORD_DETECT_TASK_STACK_SIZE, this, 3, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+#else
     xTaskCreate([](void* arg) {
         auto this_ = (WakeWordDetect*)arg;
         this_->AudioDetectionTask();
         vTaskDelete(NULL);
-    }, "audio_detection", 4096, this, 3, nullptr);
+    }, "audio_detection", WAKE_WORD_DETECT_TASK_STACK_SIZE, this, 3, nullptr);
+#endif
 }
 
 void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -79,6 +98,17 @@ void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wa
 }
 
 void WakeWordDetect::StartDetection() {
+#if CONFIG_WAKE_WORD_PREROLL_ENCODE
+    {
+        // Audio from before the last detection must not be sent again
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+        preroll_count_ = 0;
+        preroll_pcm_count_ = 0;
+        if (preroll_encoder_) {
+            preroll_encoder_->ResetState();
+        }
+    }
+#endif
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
 }
 
@@ -92,13 +122,9 @@ bool WakeWordDetect::IsDetectionRunning() {
 }
 
 void WakeWordDetect::Feed(const std::vector<int16_t>& data) {
-    input_buffer_.insert(input_buffer_.end(), data.begin(), data.end());
-
-    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_) * channels_;
-    while (input_buffer_.size() >= feed_size) {
-        afe_iface_->feed(afe_data_, input_buffer_.data());
-        input_buffer_.erase(input_buffer_.begin(), input_buffer_.begin() + feed_size);
-    }
+    feed_buffer_.Append(data.data(), data.size(), [this](const int16_t* chunk) {
+        afe_iface_->feed(afe_data_, chunk);
+    });
 }
 
 void WakeWordDetect::AudioDetectionTask() {
@@ -108,7 +134,19 @@ void WakeWordDetect::AudioDetectionTask() {
         feed_size, fetch_size);
 
     while (true) {
-        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+        auto bits = xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT | PREROLL_REENCODE_EVENT,
+            pdFALSE, pdFALSE, portMAX_DELAY);
+#if CONFIG_WAKE_WORD_PREROLL_ENCODE
+        // This task already has the stack the encoder needs
+        if (bits & PREROLL_REENCODE_EVENT) {
+            xEventGroupClearBits(event_group_, PREROLL_REENCODE_EVENT);
+            ReencodePreroll();
+            continue;
+        }
+#endif
+        if (!(bits & DETECTION_RUNNING_EVENT)) {
+            continue;
+        }
 
         auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
         if (res == nullptr || res->ret_value == ESP_FAIL) {
@@ -129,6 +167,119 @@ void WakeWordDetect::AudioDetectionTask() {
     }
 }
 
+#if CONFIG_WAKE_WORD_PREROLL_ENCODE
+void WakeWordDetect::CreatePrerollEncoder(int frame_duration_ms) {
+    preroll_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_duration_ms);
+    preroll_encoder_->SetComplexity(0); // 0 is the fastest
+    preroll_frame_duration_ = frame_duration_ms;
+    preroll_ring_.resize(WAKE_WORD_PREROLL_MS / frame_duration_ms);
+    for (auto& packet : preroll_ring_) {
+        packet.reserve(WAKE_WORD_PREROLL_PACKET_SIZE);
+    }
+    preroll_head_ = 0;
+    preroll_count_ = 0;
+}
+
+void WakeWordDetect::SetFrameDuration(int frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    if (frame_duration_ms != preroll_frame_duration_) {
+        CreatePrerollEncoder(frame_duration_ms);
+    }
+}
+
+void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    if (preroll_pcm_ != nullptr) {
+        // Keep the last WAKE_WORD_PREROLL_SAMPLES, oldest first from preroll_pcm_head_
+        for (size_t i = 0; i < samples; i++) {
+            size_t tail = (preroll_pcm_head_ + preroll_pcm_count_) % WAKE_WORD_PREROLL_SAMPLES;
+            preroll_pcm_[tail] = data[i];
+            if (preroll_pcm_count_ < WAKE_WORD_PREROLL_SAMPLES) {
+                preroll_pcm_count_++;
+            } else {
+                preroll_pcm_head_ = (preroll_pcm_head_ + 1) % WAKE_WORD_PREROLL_SAMPLES;
+            }
+        }
+    }
+    preroll_encoder_->Encode(std::vector<int16_t>(data, data + samples), [this](std::vector<uint8_t>&& opus) {
+        // Overwrite the oldest packet once the ring is full
+        size_t tail = (preroll_head_ + preroll_count_) % preroll_ring_.size();
+        preroll_ring_[tail].assign(opus.begin(), opus.end());
+        if (preroll_count_ < preroll_ring_.size()) {
+            preroll_count_++;
+        } else {
+            preroll_head_ = (preroll_head_ + 1) % preroll_ring_.size();
+        }
+    });
+}
+
+void WakeWordDetect::EncodeWakeWordData(int frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    wake_word_opus_.clear();
+    wake_word_frame_duration_ = frame_duration_ms;
+    if (frame_duration_ms != preroll_frame_duration_ && preroll_pcm_ != nullptr) {
+        // The server picked another duration, the detection task encodes the PCM again
+        ESP_LOGI(TAG, "Server frame duration %d ms, pre-roll encoded with %d ms, re-encoding",
+            frame_duration_ms, preroll_frame_duration_);
+        preroll_count_ = 0;
+        xEventGroupSetBits(event_group_, PREROLL_REENCODE_EVENT);
+        return;
+    }
+    if (frame_duration_ms == preroll_frame_duration_) {
+        // Already encoded, copied out so the ring keeps its buffers
+        for (size_t i = 0; i < preroll_count_; i++) {
+            wake_word_opus_.push_back(preroll_ring_[(preroll_head_ + i) % preroll_ring_.size()]);
+        }
+    } else {
+        ESP_LOGW(TAG, "No PCM to re-encode the pre-roll with %d ms frames, wake word audio dropped", frame_duration_ms);
+    }
+    preroll_count_ = 0;
+    preroll_pcm_count_ = 0;
+    ESP_LOGI(TAG, "Wake word pre-roll: %zu packets", wake_word_opus_.size());
+    wake_word_opus_.push_back(std::vector<uint8_t>());
+    wake_word_cv_.notify_all();
+}
+
+void WakeWordDetect::ReencodePreroll() {
+    auto start_time = esp_timer_get_time();
+    auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, wake_word_frame_duration_);
+    encoder->SetComplexity(0); // 0 is the fastest
+
+    // The PCM ring is only written by this task, and detection is stopped until the packets are sent.
+    // One frame per call, so the encoder never shifts a large buffer.
+    size_t frame_samples = 16000 / 1000 * wake_word_frame_duration_;
+    size_t head, samples;
+    {
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+        head = preroll_pcm_head_;
+        samples = preroll_pcm_count_;
+    }
+    size_t packets = 0;
+    for (size_t offset = 0; offset < samples;) {
+        size_t start = (head + offset) % WAKE_WORD_PREROLL_SAMPLES;
+        size_t count = std::min({samples - offset, WAKE_WORD_PREROLL_SAMPLES - start, frame_samples});
+        encoder->Encode(std::vector<int16_t>(preroll_pcm_ + start, preroll_pcm_ + start + count),
+            [this, &packets](std::vector<uint8_t>&& opus) {
+            std::lock_guard<std::mutex> lock(wake_word_mutex_);
+            wake_word_opus_.emplace_back(std::move(opus));
+            wake_word_cv_.notify_all();
+            packets++;
+        });
+        offset += count;
+    }
+    ESP_LOGI(TAG, "Re-encoded wake word pre-roll, %zu packets in %lld ms",
+        packets, (esp_timer_get_time() - start_time) / 1000);
+
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    preroll_pcm_count_ = 0;
+    wake_word_opus_.push_back(std::vector<uint8_t>());
+    wake_word_cv_.notify_all();
+}
+#else
+void WakeWordDetect::SetFrameDuration(int frame_duration_ms) {
+    // Encoded with the requested duration on detection, nothing to prepare
+}
+
 void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
     // store audio data to wake_word_pcm_
     wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
@@ -138,8 +289,9 @@ void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
     }
 }
 
-void WakeWordDetect::EncodeWakeWordData() {
+void WakeWordDetect::EncodeWakeWordData(int frame_duration_ms) {
     wake_word_opus_.clear();
+    wake_word_frame_duration_ = frame_duration_ms;
     if (wake_word_encode_task_stack_ == nullptr) {
         wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
     }
@@ -147,7 +299,7 @@ void WakeWordDetect::EncodeWakeWordData() {
         auto this_ = (WakeWordDetect*)arg;
         {
             auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, this_->wake_word_frame_duration_);
             encoder->SetComplexity(0); // 0 is the fastest
 
             for (auto& pcm: this_->wake_word_pcm_) {
@@ -170,6 +322,7 @@ void WakeWordDetect::EncodeWakeWordData() {
         vTaskDelete(NULL);
     }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
 }
+#endif
 
 bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
     std::unique_lock<std::mutex> lock(wake_word_mutex_);
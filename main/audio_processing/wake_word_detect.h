@@ -8,26 +8,45 @@
 #include <esp_afe_sr_models.h>
 #include <esp_nsn_models.h>
 
+#include <opus_encoder.h>
+
+#include "afe_feed_buffer.h"
+
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
 
+// Audio kept before the wake word, sent to the server for speaker recognition
+#define WAKE_WORD_PREROLL_MS 2000
+// Room reserved for each pre-roll packet, a complexity 0 frame is much smaller
+#define WAKE_WORD_PREROLL_PACKET_SIZE 256
+#define WAKE_WORD_PREROLL_SAMPLES (16000 / 1000 * WAKE_WORD_PREROLL_MS)
+#if CONFIG_WAKE_WORD_PREROLL_ENCODE
+// The detection task runs the Opus encoder, which needs as much stack as the encode task
+#define WAKE_WORD_DETECT_TASK_STACK_SIZE (4096 * 8)
+#else
+#define WAKE_WORD_DETECT_TASK_STACK_SIZE 4096
+#endif
 
 class WakeWordDetect {
 public:
     WakeWordDetect();
     ~WakeWordDetect();
 
-    void Initialize(int channels, bool reference);
+    void Initialize(int channels, bool reference, int frame_duration_ms);
+    // The pre-roll is encoded ahead with the frame duration proposed to the server
+    void SetFrameDuration(int frame_duration_ms);
     void Feed(const std::vector<int16_t>& data);
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
     void StartDetection();
     void StopDetection();
     bool IsDetectionRunning();
-    void EncodeWakeWordData();
+    // frame_duration_ms is the duration agreed with the server, the packets are read with GetWakeWordOpus()
+    void EncodeWakeWordData(int frame_duration_ms);
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
@@ -36,7 +55,7 @@ private:
     esp_afe_sr_data_t* afe_data_ = nullptr;
     char* wakenet_model_ = NULL;
     std::vector<std::string> wake_words_;
-    std::vector<int16_t> input_buffer_;
+    AfeFeedBuffer feed_buffer_;
     EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     int channels_;
@@ -44,12 +63,28 @@ private:
     std::string last_detected_wake_word_;
 
     TaskHandle_t wake_word_encode_task_ = nullptr;
+    int wake_word_frame_duration_ = 60;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
     std::list<std::vector<int16_t>> wake_word_pcm_;
     std::list<std::vector<uint8_t>> wake_word_opus_;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
+#if CONFIG_WAKE_WORD_PREROLL_ENCODE
+    // Encoded while idle into a ring of WAKE_WORD_PREROLL_MS, the packets keep their capacity
+    std::unique_ptr<OpusEncoderWrapper> preroll_encoder_;
+    int preroll_frame_duration_ = 0;
+    std::vector<std::vector<uint8_t>> preroll_ring_;
+    size_t preroll_head_ = 0;
+    size_t preroll_count_ = 0;
+    // The same audio as PCM, re-encoded if the server picks another frame duration
+    int16_t* preroll_pcm_ = nullptr;
+    size_t preroll_pcm_head_ = 0;
+    size_t preroll_pcm_count_ = 0;
+
+    void CreatePrerollEncoder(int frame_duration_ms);
+    void ReencodePreroll();
+#endif
 
     void StoreWakeWordData(uint16_t* data, size_t size);
     void AudioDetectionTask();
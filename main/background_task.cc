@@ -5,7 +5,8 @@
 
 #define TAG "BackgroundTask"
 
-BackgroundTask::BackgroundTask(uint32_t stack_size) {
+BackgroundTask::BackgroundTask(uint32_t stack_size, size_t capacity, BackgroundTaskPolicy policy)
+    : policy_(policy), slots_(capacity) {
     xTaskCreate([](void* arg) {
         BackgroundTask* task = (BackgroundTask*)arg;
         task->BackgroundTaskLoop();
@@ -18,46 +19,96 @@ BackgroundTask::~BackgroundTask() {
     }
 }
 
-void BackgroundTask::Schedule(std::function<void()> callback) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (active_tasks_ >= 30) {
-        int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
-        if (free_sram < 10000) {
-            ESP_LOGW(TAG, "active_tasks_ == %u, free_sram == %u", active_tasks_.load(), free_sram);
-        }
-    }
-    active_tasks_++;
-    main_tasks_.emplace_back([this, cb = std::move(callback)]() {
-        cb();
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            active_tasks_--;
-            if (main_tasks_.empty() && active_tasks_ == 0) {
-                condition_variable_.notify_all();
+bool BackgroundTask::Schedule(Callback&& callback, bool droppable) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (count_ == slots_.size()) {
+        if (droppable && policy_ == kBackgroundTaskReject) {
+            if (rejected_++ % 100 == 0) {
+                ESP_LOGW(TAG, "Queue full, rejected %zu callbacks", rejected_);
             }
+            return false;
         }
-    });
+        if (!(droppable && policy_ == kBackgroundTaskDropOldest && DropOldestDroppable())) {
+            condition_variable_.wait(lock, [this]() { return count_ < slots_.size(); });
+        }
+    }
+
+    auto& slot = slots_[(head_ + count_) % slots_.size()];
+    slot.callback = std::move(callback);
+    slot.droppable = droppable;
+    count_++;
+    if (count_ > high_water_mark_) {
+        high_water_mark_ = count_;
+    }
     condition_variable_.notify_all();
+    return true;
+}
+
+// Removes the oldest droppable callback and closes the gap, called with the mutex held
+bool BackgroundTask::DropOldestDroppable() {
+    for (size_t i = 0; i < count_; i++) {
+        if (!slots_[(head_ + i) % slots_.size()].droppable) {
+            continue;
+        }
+        for (size_t j = i; j + 1 < count_; j++) {
+            slots_[(head_ + j) % slots_.size()] = std::move(slots_[(head_ + j + 1) % slots_.size()]);
+        }
+        auto& last = slots_[(head_ + count_ - 1) % slots_.size()];
+        last.callback.Reset();
+        last.droppable = false;
+        count_--;
+        if (dropped_++ % 100 == 0) {
+            ESP_LOGW(TAG, "Queue full, dropped %zu callbacks", dropped_);
+        }
+        return true;
+    }
+    return false;
+}
+
+size_t BackgroundTask::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+}
+
+size_t BackgroundTask::high_water_mark() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return high_water_mark_;
+}
+
+size_t BackgroundTask::dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
+
+size_t BackgroundTask::rejected() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rejected_;
 }
 
 void BackgroundTask::WaitForCompletion() {
     std::unique_lock<std::mutex> lock(mutex_);
     condition_variable_.wait(lock, [this]() {
-        return main_tasks_.empty() && active_tasks_ == 0;
+        return count_ == 0 && !running_;
     });
 }
 
 void BackgroundTask::BackgroundTaskLoop() {
     ESP_LOGI(TAG, "background_task started");
+    Callback task;
     while (true) {
         std::unique_lock<std::mutex> lock(mutex_);
-        condition_variable_.wait(lock, [this]() { return !main_tasks_.empty(); });
-        
-        std::list<std::function<void()>> tasks = std::move(main_tasks_);
+        running_ = false;
+        // Wakes up WaitForCompletion() and producers blocked on a full queue
+        condition_variable_.notify_all();
+        condition_variable_.wait(lock, [this]() { return count_ > 0; });
+
+        task = std::move(slots_[head_].callback);
+        head_ = (head_ + 1) % slots_.size();
+        count_--;
+        running_ = true;
         lock.unlock();
 
-        for (auto& task : tasks) {
-            task();
-        }
+        task();
+        task.Reset();
     }
 }
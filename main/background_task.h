@@ -4,26 +4,68 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <mutex>
-#include <list>
+#include <vector>
 #include <condition_variable>
-#include <atomic>
+
+#include "inplace_function.h"
+
+#ifdef CONFIG_BACKGROUND_TASK_CALLABLE_SIZE
+#define BACKGROUND_TASK_CALLABLE_SIZE CONFIG_BACKGROUND_TASK_CALLABLE_SIZE
+#else
+#define BACKGROUND_TASK_CALLABLE_SIZE 32
+#endif
+#define BACKGROUND_TASK_QUEUE_CAPACITY 32
+
+// What Schedule does with a droppable callback when the queue is full,
+// other callbacks always wait for room so control work is never lost
+enum BackgroundTaskPolicy {
+    kBackgroundTaskBlock,       // Wait until the task has made room
+    kBackgroundTaskDropOldest,  // Discard the oldest queued droppable callback, or wait if there is none
+    kBackgroundTaskReject       // Discard the new callback
+};
 
 class BackgroundTask {
 public:
-    BackgroundTask(uint32_t stack_size = 4096 * 2);
+    using Callback = InplaceFunction<BACKGROUND_TASK_CALLABLE_SIZE>;
+
+    BackgroundTask(uint32_t stack_size = 4096 * 2, size_t capacity = BACKGROUND_TASK_QUEUE_CAPACITY,
+        BackgroundTaskPolicy policy = kBackgroundTaskBlock);
     ~BackgroundTask();
 
-    void Schedule(std::function<void()> callback);
+    // Returns false if the callback was rejected. Only droppable callbacks, e.g. PCM frames,
+    // are subject to the policy
+    bool Schedule(Callback&& callback, bool droppable = false);
     void WaitForCompletion();
 
+    inline size_t capacity() const { return slots_.size(); }
+    size_t size() const;
+    size_t high_water_mark() const;
+    size_t dropped() const;
+    size_t rejected() const;
+
 private:
-    std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    struct Slot {
+        Callback callback;
+        bool droppable = false;
+    };
+
+    mutable std::mutex mutex_;
     std::condition_variable condition_variable_;
     TaskHandle_t background_task_handle_ = nullptr;
-    std::atomic<size_t> active_tasks_{0};
+    BackgroundTaskPolicy policy_;
+
+    // Fixed ring of callbacks, allocated once in the constructor
+    std::vector<Slot> slots_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    bool running_ = false;
+
+    size_t high_water_mark_ = 0;
+    size_t dropped_ = 0;
+    size_t rejected_ = 0;
 
     void BackgroundTaskLoop();
+    bool DropOldestDroppable();
 };
 
 #endif
@@ -107,6 +107,9 @@ private:
         };
         gpio_config(&io_conf);  // 应用配置
 
+        boot_button_.OnPressDown([this]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             auto& app = Application::GetInstance();
             if (app.GetDeviceState() == kDeviceStateStarting && !WifiStation::GetInstance().IsConnected()) {
@@ -138,6 +138,9 @@ private:
 
  
     void InitializeButtons() {
+        boot_button_.OnPressDown([this]() {
+            Application::GetInstance().PrewarmAudioChannel();
+        });
         boot_button_.OnClick([this]() {
             auto& app = Application::GetInstance();
             if (app.GetDeviceState() == kDeviceStateStarting && !WifiStation::GetInstance().IsConnected()) {
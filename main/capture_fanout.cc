@@ -0,0 +1,113 @@
+#include "capture_fanout.h"
+
+#include <esp_log.h>
+
+#define TAG "CaptureFanout"
+
+CaptureFanout::CaptureFanout(size_t frames) : frames_(frames) {
+}
+
+int CaptureFanout::AddConsumer(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (consumer_count_ >= CAPTURE_FANOUT_MAX_CONSUMERS) {
+        ESP_LOGE(TAG, "Too many consumers, %s not added", name);
+        return -1;
+    }
+    consumers_[consumer_count_].name = name;
+    return consumer_count_++;
+}
+
+void CaptureFanout::SetActive(int consumer, bool active) {
+    if (consumer < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& c = consumers_[consumer];
+    if (c.active == active) {
+        return;
+    }
+    c.active = active;
+    c.cursor = write_sequence_;
+}
+
+CaptureFrame* CaptureFanout::BeginWrite() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The frame about to be overwritten, sequence arithmetic wraps around
+    uint32_t oldest = write_sequence_ - frames_.size();
+
+    for (int i = 0; i < consumer_count_; i++) {
+        auto& c = consumers_[i];
+        if (c.pinned && c.pinned_sequence == oldest) {
+            // Never overwrite a frame while it is being read
+            if (overruns_++ % 100 == 0) {
+                ESP_LOGW(TAG, "Consumer %s is reading the oldest frame, %lu frames dropped", c.name, overruns_);
+            }
+            return nullptr;
+        }
+    }
+    for (int i = 0; i < consumer_count_; i++) {
+        auto& c = consumers_[i];
+        if (c.active && (int32_t)(c.cursor - oldest) <= 0) {
+            // The consumer is a whole ring behind, it loses its oldest frame
+            c.cursor = oldest + 1;
+            if (c.dropped++ % 100 == 0) {
+                ESP_LOGW(TAG, "Consumer %s is too slow, %lu frames dropped", c.name, c.dropped);
+            }
+        }
+    }
+    return &frames_[write_sequence_ % frames_.size()];
+}
+
+void CaptureFanout::EndWrite() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_[write_sequence_ % frames_.size()].sequence = write_sequence_;
+    write_sequence_++;
+}
+
+CaptureFrame* CaptureFanout::Acquire(int consumer, bool* last_reader) {
+    if (consumer < 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& c = consumers_[consumer];
+    if (!c.active || c.cursor == write_sequence_) {
+        return nullptr;
+    }
+    c.pinned = true;
+    c.pinned_sequence = c.cursor;
+
+    if (last_reader != nullptr) {
+        // Consumers activated later start at write_sequence_, so only active ones still behind count
+        *last_reader = true;
+        for (int i = 0; i < consumer_count_; i++) {
+            auto& other = consumers_[i];
+            if (i != consumer && other.active && (int32_t)(other.cursor - c.cursor) <= 0) {
+                *last_reader = false;
+                break;
+            }
+        }
+    }
+    return &frames_[c.cursor % frames_.size()];
+}
+
+void CaptureFanout::Release(int consumer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& c = consumers_[consumer];
+    c.pinned = false;
+    // The cursor may have been moved by SetActive() while the frame was read
+    if (c.cursor == c.pinned_sequence) {
+        c.cursor++;
+        c.frames++;
+    }
+}
+
+CaptureConsumerStats CaptureFanout::stats(int consumer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CaptureConsumerStats stats;
+    if (consumer >= 0 && consumer < consumer_count_) {
+        stats.name = consumers_[consumer].name;
+        stats.frames = consumers_[consumer].frames;
+        stats.dropped = consumers_[consumer].dropped;
+    }
+    return stats;
+}
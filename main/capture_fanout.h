@@ -0,0 +1,91 @@
+#ifndef CAPTURE_FANOUT_H
+#define CAPTURE_FANOUT_H
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+// About 240ms of 30ms capture frames
+#define CAPTURE_FANOUT_FRAMES 8
+#define CAPTURE_FANOUT_MAX_CONSUMERS 4
+
+struct CaptureFrame {
+    std::vector<int16_t> data;
+    int64_t timestamp = 0;
+    uint32_t sequence = 0;
+};
+
+struct CaptureConsumerStats {
+    const char* name = nullptr;
+    uint32_t frames = 0;
+    uint32_t dropped = 0;
+};
+
+// One ring of captured frames shared by every consumer of the microphone.
+// The main loop writes each frame once, and every consumer reads it through its
+// own cursor. A frame being read is pinned and never overwritten; a consumer
+// that falls a whole ring behind loses its oldest frames, which are counted,
+// instead of making the capture path buffer more.
+class CaptureFanout {
+public:
+    CaptureFanout(size_t frames = CAPTURE_FANOUT_FRAMES);
+
+    // Returns the consumer id, consumers are registered once at startup
+    int AddConsumer(const char* name);
+    // Inactive consumers hold no frames, once activated they start at the next frame
+    void SetActive(int consumer, bool active);
+
+    // Producer side: fill the returned frame, then commit it.
+    // Returns nullptr if the oldest frame is still pinned by a reader.
+    CaptureFrame* BeginWrite();
+    void EndWrite();
+
+    // Calls handler for every frame the consumer has not read yet
+    template <typename Handler>
+    void Consume(int consumer, Handler&& handler) {
+        const CaptureFrame* frame;
+        while ((frame = Acquire(consumer)) != nullptr) {
+            handler(*frame);
+            Release(consumer);
+        }
+    }
+
+    // Like Consume(), but handler(frame, last_reader) may move the samples out of
+    // the frame when last_reader is true, no other consumer will read it then
+    template <typename Handler>
+    void ConsumeOrTake(int consumer, Handler&& handler) {
+        CaptureFrame* frame;
+        bool last_reader;
+        while ((frame = Acquire(consumer, &last_reader)) != nullptr) {
+            handler(*frame, last_reader);
+            Release(consumer);
+        }
+    }
+
+    CaptureConsumerStats stats(int consumer);
+    inline uint32_t overruns() const { return overruns_; }
+    inline int consumer_count() const { return consumer_count_; }
+
+private:
+    struct Consumer {
+        const char* name = nullptr;
+        bool active = false;
+        bool pinned = false;
+        uint32_t pinned_sequence = 0;
+        uint32_t cursor = 0;
+        uint32_t frames = 0;
+        uint32_t dropped = 0;
+    };
+
+    std::mutex mutex_;
+    std::vector<CaptureFrame> frames_;
+    Consumer consumers_[CAPTURE_FANOUT_MAX_CONSUMERS];
+    int consumer_count_ = 0;
+    uint32_t write_sequence_ = 0;
+    uint32_t overruns_ = 0;
+
+    CaptureFrame* Acquire(int consumer, bool* last_reader = nullptr);
+    void Release(int consumer);
+};
+
+#endif // CAPTURE_FANOUT_H
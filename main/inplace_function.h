@@ -0,0 +1,93 @@
+#ifndef INPLACE_FUNCTION_H
+#define INPLACE_FUNCTION_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A move-only void() callable stored inside the object itself. Unlike std::function
+// it never allocates: a capture larger than Capacity is rejected at compile time.
+template<size_t Capacity>
+class InplaceFunction {
+public:
+    InplaceFunction() = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InplaceFunction>>>
+    InplaceFunction(F&& callable) {
+        using Callable = std::decay_t<F>;
+        static_assert(sizeof(Callable) <= Capacity, "Capture too large for InplaceFunction, raise the capacity");
+        static_assert(alignof(Callable) <= alignof(std::max_align_t), "Capture alignment not supported");
+        new (storage_) Callable(std::forward<F>(callable));
+        ops_ = &OpsFor<Callable>::ops;
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+    ~InplaceFunction() {
+        Reset();
+    }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const {
+        return ops_ != nullptr;
+    }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* from, void* to);
+        void (*destroy)(void* storage);
+    };
+
+    template<typename Callable>
+    struct OpsFor {
+        static void Invoke(void* storage) {
+            (*static_cast<Callable*>(storage))();
+        }
+        static void Move(void* from, void* to) {
+            new (to) Callable(std::move(*static_cast<Callable*>(from)));
+            static_cast<Callable*>(from)->~Callable();
+        }
+        static void Destroy(void* storage) {
+            static_cast<Callable*>(storage)->~Callable();
+        }
+        static constexpr Ops ops = { Invoke, Move, Destroy };
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity];
+    const Ops* ops_ = nullptr;
+
+    void MoveFrom(InplaceFunction& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(other.storage_, storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+};
+
+#endif // INPLACE_FUNCTION_H
@@ -1,6 +1,7 @@
 #include "thing_manager.h"
 
 #include <esp_log.h>
+#include <mbedtls/sha256.h>
 
 #define TAG "ThingManager"
 
@@ -8,18 +9,39 @@ namespace iot {
 
 void ThingManager::AddThing(Thing* thing) {
     things_.push_back(thing);
+    descriptors_.clear();
+    descriptors_hash_.clear();
 }
 
-std::string ThingManager::GetDescriptorsJson() {
-    std::string json_str = "[";
-    for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+const std::vector<std::string>& ThingManager::GetDescriptors() {
+    if (descriptors_.empty()) {
+        for (auto& thing : things_) {
+            descriptors_.push_back(thing->GetDescriptorJson());
+        }
     }
-    if (json_str.back() == ',') {
-        json_str.pop_back();
+    return descriptors_;
+}
+
+const std::string& ThingManager::GetDescriptorsHash() {
+    if (descriptors_hash_.empty()) {
+        mbedtls_sha256_context ctx;
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts(&ctx, 0);
+        for (auto& descriptor : GetDescriptors()) {
+            mbedtls_sha256_update(&ctx, (const unsigned char*)descriptor.data(), descriptor.size());
+        }
+        uint8_t digest[32];
+        mbedtls_sha256_finish(&ctx, digest);
+        mbedtls_sha256_free(&ctx);
+
+        // The first 8 bytes are enough to tell firmware builds apart
+        static const char hex_chars[] = "0123456789abcdef";
+        for (int i = 0; i < 8; i++) {
+            descriptors_hash_.push_back(hex_chars[digest[i] >> 4]);
+            descriptors_hash_.push_back(hex_chars[digest[i] & 0x0F]);
+        }
     }
-    json_str += "]";
-    return json_str;
+    return descriptors_hash_;
 }
 
 bool ThingManager::GetStatesJson(std::string& json, bool delta) {
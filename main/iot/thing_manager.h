@@ -24,7 +24,9 @@ public:
 
     void AddThing(Thing* thing);
 
-    std::string GetDescriptorsJson();
+    // Built once, things are only added while the board starts
+    const std::vector<std::string>& GetDescriptors();
+    const std::string& GetDescriptorsHash();
     bool GetStatesJson(std::string& json, bool delta = false);
     void Invoke(const cJSON* command);
 
@@ -34,6 +36,8 @@ private:
 
     std::vector<Thing*> things_;
     std::map<std::string, std::string> last_states_;
+    std::vector<std::string> descriptors_;
+    std::string descriptors_hash_;
 };
 
 
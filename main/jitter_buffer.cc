@@ -0,0 +1,186 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "JitterBuffer"
+
+JitterBuffer::JitterBuffer(int frame_duration_ms, size_t max_frames)
+    : slots_(max_frames), frame_duration_ms_(frame_duration_ms) {
+}
+
+void JitterBuffer::SetFrameDuration(int frame_duration_ms) {
+    if (frame_duration_ms_ != frame_duration_ms) {
+        frame_duration_ms_ = frame_duration_ms;
+        Reset();
+    }
+}
+
+void JitterBuffer::Reset() {
+    if (stats_.received > 0) {
+        ESP_LOGI(TAG, "received %lu played %lu late %lu duplicated %lu lost %lu concealed %lu underruns %lu, jitter %dms delay %d frames",
+            stats_.received, stats_.played, stats_.late, stats_.duplicated, stats_.lost, stats_.concealed,
+            stats_.underruns, jitter_ms(), target_frames_);
+    }
+    for (auto& slot : slots_) {
+        slot.packet = AudioPacket();
+        slot.valid = false;
+    }
+    stats_ = JitterBufferStats();
+    started_ = false;
+    playing_ = false;
+    drained_ = false;
+    buffered_ = 0;
+    concealed_in_row_ = 0;
+    has_transit_ = false;
+    // Keep the jitter estimate and the delay, the network usually does not change between replies
+}
+
+bool JitterBuffer::HasRoom() const {
+    if (!started_) {
+        return true;
+    }
+    return (int32_t)(highest_sequence_ + 1 - next_sequence_) < (int32_t)slots_.size();
+}
+
+void JitterBuffer::Put(AudioPacket&& packet) {
+    auto now = esp_timer_get_time();
+    uint32_t sequence = packet.sequence();
+    if (sequence == 0) {
+        // The transport has no sequence numbers, keep the arrival order
+        sequence = started_ ? highest_sequence_ + 1 : 1;
+    }
+    stats_.received++;
+    if (drained_) {
+        // Ran dry while playing and the stream went on, the end of a reply is not counted
+        drained_ = false;
+        stats_.underruns++;
+    }
+
+    if (!started_) {
+        started_ = true;
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+    }
+
+    int32_t ahead = (int32_t)(sequence - next_sequence_);
+    if (ahead < 0) {
+        stats_.late++;
+        return;
+    }
+    if (ahead >= (int32_t)slots_.size()) {
+        // Far ahead of the playout point, resynchronize on this packet
+        ESP_LOGW(TAG, "Sequence jumped from %lu to %lu", next_sequence_, sequence);
+        for (auto& slot : slots_) {
+            slot.packet = AudioPacket();
+            slot.valid = false;
+        }
+        stats_.lost += ahead - (int32_t)buffered_;
+        buffered_ = 0;
+        next_sequence_ = sequence;
+    }
+
+    auto& slot = SlotOf(sequence);
+    if (slot.valid) {
+        stats_.duplicated++;
+        return;
+    }
+    slot.packet = std::move(packet);
+    slot.packet.set_sequence(sequence);
+    slot.arrival_time = now;
+    slot.valid = true;
+    buffered_++;
+    if ((int32_t)(sequence - highest_sequence_) > 0) {
+        highest_sequence_ = sequence;
+    }
+    UpdateJitter(sequence, now);
+}
+
+JitterBufferResult JitterBuffer::Get(AudioPacket& packet) {
+    if (buffered_ == 0) {
+        // Ran dry, build up the playout delay again before resuming
+        drained_ = drained_ || playing_;
+        playing_ = false;
+        return kJitterBufferEmpty;
+    }
+
+    auto now = esp_timer_get_time();
+    if (!playing_) {
+        if ((int)buffered_ < target_frames_ && !WaitedLongEnough(now)) {
+            return kJitterBufferEmpty;
+        }
+        playing_ = true;
+    }
+
+    auto& slot = SlotOf(next_sequence_);
+    if (slot.valid) {
+        packet = std::move(slot.packet);
+        slot.valid = false;
+        buffered_--;
+        next_sequence_++;
+        concealed_in_row_ = 0;
+        stats_.played++;
+        return kJitterBufferFrame;
+    }
+
+    // The next packet is missing, give it the playout delay to arrive
+    if ((int)buffered_ < target_frames_ && !WaitedLongEnough(now)) {
+        return kJitterBufferEmpty;
+    }
+
+    if (concealed_in_row_ < JITTER_BUFFER_MAX_CONCEALED_FRAMES) {
+        next_sequence_++;
+        concealed_in_row_++;
+        stats_.lost++;
+        stats_.concealed++;
+        packet = AudioPacket();
+        return kJitterBufferLost;
+    }
+
+    // A long gap is not worth concealing, jump to the next packet we have
+    while (!SlotOf(next_sequence_).valid) {
+        Skip();
+    }
+    return Get(packet);
+}
+
+void JitterBuffer::Skip() {
+    auto& slot = SlotOf(next_sequence_);
+    if (slot.valid) {
+        slot.packet = AudioPacket();
+        slot.valid = false;
+        buffered_--;
+    }
+    stats_.lost++;
+    next_sequence_++;
+}
+
+bool JitterBuffer::WaitedLongEnough(int64_t now) const {
+    int64_t oldest = now;
+    for (auto& slot : slots_) {
+        if (slot.valid && slot.arrival_time < oldest) {
+            oldest = slot.arrival_time;
+        }
+    }
+    return now - oldest >= (int64_t)target_frames_ * frame_duration_ms_ * 1000;
+}
+
+void JitterBuffer::UpdateJitter(uint32_t sequence, int64_t arrival_time) {
+    int64_t frame_us = frame_duration_ms_ * 1000;
+    int64_t transit = arrival_time - (int64_t)sequence * frame_us;
+    if (has_transit_) {
+        // Only late arrivals count, a reply burst sent faster than realtime is not jitter
+        int64_t d = transit - last_transit_us_;
+        if (d < 0) {
+            d = 0;
+        }
+        jitter_us_ += (d - jitter_us_) / 16;
+    }
+    has_transit_ = true;
+    last_transit_us_ = transit;
+
+    // Cover about 3 times the mean deviation, at least one frame
+    int target = 1 + (int)((3 * jitter_us_ + frame_us - 1) / frame_us);
+    int max_target = slots_.size() / 2;
+    target_frames_ = target > max_target ? max_target : target;
+}
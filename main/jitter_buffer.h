@@ -0,0 +1,81 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include "audio_packet_pool.h"
+
+#include <vector>
+#include <cstdint>
+
+// About 2 seconds of 60ms frames
+#define JITTER_BUFFER_MAX_FRAMES 32
+// Gaps longer than this are skipped instead of concealed
+#define JITTER_BUFFER_MAX_CONCEALED_FRAMES 3
+
+enum JitterBufferResult {
+    kJitterBufferEmpty,
+    kJitterBufferFrame,
+    kJitterBufferLost
+};
+
+struct JitterBufferStats {
+    uint32_t received = 0;
+    uint32_t played = 0;
+    uint32_t late = 0;
+    uint32_t duplicated = 0;
+    uint32_t lost = 0;
+    uint32_t concealed = 0;
+    uint32_t underruns = 0;
+};
+
+// Reorders downlink packets by sequence number and sizes its playout delay
+// from the measured arrival jitter (RFC 3550 estimator). Not thread safe,
+// it is owned by the task that feeds the decoder.
+class JitterBuffer {
+public:
+    JitterBuffer(int frame_duration_ms, size_t max_frames = JITTER_BUFFER_MAX_FRAMES);
+
+    void SetFrameDuration(int frame_duration_ms);
+    void Reset();
+    // False while the window from the playout point to the newest packet fills every slot,
+    // the caller should keep further packets queued until a frame has been played
+    bool HasRoom() const;
+    void Put(AudioPacket&& packet);
+    // On kJitterBufferLost the packet is left empty, decode it to run the codec's PLC
+    JitterBufferResult Get(AudioPacket& packet);
+
+    inline const JitterBufferStats& stats() const { return stats_; }
+    inline int jitter_ms() const { return jitter_us_ / 1000; }
+    inline int target_frames() const { return target_frames_; }
+    inline size_t buffered() const { return buffered_; }
+
+private:
+    struct Slot {
+        AudioPacket packet;
+        int64_t arrival_time = 0;
+        bool valid = false;
+    };
+
+    std::vector<Slot> slots_;
+    int frame_duration_ms_;
+    JitterBufferStats stats_;
+
+    bool started_ = false;
+    bool playing_ = false;
+    bool drained_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    size_t buffered_ = 0;
+    int concealed_in_row_ = 0;
+    int target_frames_ = 1;
+
+    bool has_transit_ = false;
+    int64_t last_transit_us_ = 0;
+    int64_t jitter_us_ = 0;
+
+    inline Slot& SlotOf(uint32_t sequence) { return slots_[sequence % slots_.size()]; }
+    void UpdateJitter(uint32_t sequence, int64_t arrival_time);
+    bool WaitedLongEnough(int64_t now) const;
+    void Skip();
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,100 @@
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstdio>
+
+#define TAG "LatencyTracer"
+
+static const char* const POINT_NAMES[] = {
+    "input_read",
+    "input_encode_start",
+    "input_encoded",
+    "input_sent",
+    "output_decode_start",
+    "output_decoded",
+    "output_written",
+};
+
+void LatencyTracer::Record(LatencyPoint point, int64_t start_time) {
+#if CONFIG_AUDIO_LATENCY_TRACE
+    if (start_time == 0) {
+        return;
+    }
+    int64_t elapsed = esp_timer_get_time() - start_time;
+    uint32_t latency_us = elapsed > 0 ? elapsed : 0;
+
+    int bucket = 0;
+    for (uint32_t ms = latency_us / 1000; ms > 0 && bucket < LATENCY_HISTOGRAM_BUCKETS - 1; ms >>= 1) {
+        bucket++;
+    }
+
+    auto& histogram = histograms_[point];
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.total_us.fetch_add(latency_us, std::memory_order_relaxed);
+    auto max_us = histogram.max_us.load(std::memory_order_relaxed);
+    while (latency_us > max_us && !histogram.max_us.compare_exchange_weak(max_us, latency_us, std::memory_order_relaxed)) {
+    }
+#endif
+}
+
+void LatencyTracer::Reset() {
+    for (auto& histogram : histograms_) {
+        for (auto& bucket : histogram.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        histogram.count.store(0, std::memory_order_relaxed);
+        histogram.max_us.store(0, std::memory_order_relaxed);
+        histogram.total_us.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyTracer::Dump() {
+    ESP_LOGI(TAG, "%-20s %8s %8s %8s  <1/<2/<4/<8/<16/<32/<64/<128/<256/<512/<1024/more ms",
+        "point", "count", "avg_ms", "max_ms");
+    for (int i = 0; i < kLatencyPointCount; i++) {
+        auto& histogram = histograms_[i];
+        uint32_t count = histogram.count.load(std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        char buckets[LATENCY_HISTOGRAM_BUCKETS * 11];
+        int length = 0;
+        for (int j = 0; j < LATENCY_HISTOGRAM_BUCKETS; j++) {
+            length += snprintf(buckets + length, sizeof(buckets) - length, j == 0 ? "%lu" : "/%lu",
+                histogram.buckets[j].load(std::memory_order_relaxed));
+        }
+        ESP_LOGI(TAG, "%-20s %8lu %8lu %8lu  %s", POINT_NAMES[i], count,
+            (uint32_t)(histogram.total_us.load(std::memory_order_relaxed) / count / 1000),
+            histogram.max_us.load(std::memory_order_relaxed) / 1000, buckets);
+    }
+}
+
+std::string LatencyTracer::GetJson() {
+    std::string json = "{";
+    char buffer[64];
+    for (int i = 0; i < kLatencyPointCount; i++) {
+        auto& histogram = histograms_[i];
+        uint32_t count = histogram.count.load(std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        if (json.size() > 1) {
+            json += ",";
+        }
+        json += "\"";
+        json += POINT_NAMES[i];
+        snprintf(buffer, sizeof(buffer), "\":{\"count\":%lu,\"avg_ms\":%lu,\"max_ms\":%lu,\"buckets\":[", count,
+            (uint32_t)(histogram.total_us.load(std::memory_order_relaxed) / count / 1000),
+            histogram.max_us.load(std::memory_order_relaxed) / 1000);
+        json += buffer;
+        for (int j = 0; j < LATENCY_HISTOGRAM_BUCKETS; j++) {
+            snprintf(buffer, sizeof(buffer), j == 0 ? "%lu" : ",%lu", histogram.buckets[j].load(std::memory_order_relaxed));
+            json += buffer;
+        }
+        json += "]}";
+    }
+    json += "}";
+    return json;
+}
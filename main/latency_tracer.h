@@ -0,0 +1,56 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+// Buckets are powers of two in milliseconds: <1, <2, <4 ... <1024, >=1024
+#define LATENCY_HISTOGRAM_BUCKETS 12
+
+// Every point is measured from the start of its direction: the I2S receive
+// callback for the uplink, the arrival of the packet for the downlink. The
+// cost of one stage is the difference between two neighbouring points.
+enum LatencyPoint {
+    kLatencyInputRead,          // Frame read by the main loop
+    kLatencyInputEncodeStart,   // Frame handed to the encoder (after AFE if enabled)
+    kLatencyInputEncoded,       // Opus packet produced
+    kLatencyInputSent,          // Opus packet sent by the protocol
+    kLatencyOutputDecodeStart,  // Packet taken out of the jitter buffer
+    kLatencyOutputDecoded,      // PCM ready in the playback ring
+    kLatencyOutputWritten,      // PCM written to the codec
+    kLatencyPointCount
+};
+
+struct LatencyHistogram {
+    std::atomic<uint32_t> buckets[LATENCY_HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> max_us{0};
+    std::atomic<uint64_t> total_us{0};
+};
+
+class LatencyTracer {
+public:
+    static LatencyTracer& GetInstance() {
+        static LatencyTracer instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    // Records now - start_time, a zero start time is ignored (e.g. local sounds)
+    void Record(LatencyPoint point, int64_t start_time);
+    void Reset();
+    // Prints a table to the serial console
+    void Dump();
+    // {"input_read":{"count":..,"avg_ms":..,"max_ms":..,"buckets":[..]}, ...}, points without samples are left out
+    std::string GetJson();
+
+private:
+    LatencyTracer() = default;
+
+    LatencyHistogram histograms_[kLatencyPointCount];
+};
+
+#endif // LATENCY_TRACER_H
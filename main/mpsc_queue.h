@@ -0,0 +1,82 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed capacity multi-producer / single-consumer ring (Vyukov's bounded queue).
+// Any task may call Push(), only one task may call Pop(). Each cell carries a
+// sequence number, so producers only contend on a single atomic counter.
+template <typename T>
+class MpscQueue {
+public:
+    // The capacity is rounded up to a power of two
+    explicit MpscQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_ = std::make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Returns false if the queue is full
+    bool Push(T&& item) {
+        size_t position = enqueue_position_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[position & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+            if (diff == 0) {
+                if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                position = enqueue_position_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(item);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item) {
+        Cell* cell = &cells_[dequeue_position_ & mask_];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        if ((intptr_t)sequence - (intptr_t)(dequeue_position_ + 1) < 0) {
+            return false;
+        }
+        item = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(dequeue_position_ + mask_ + 1, std::memory_order_release);
+        dequeue_position_++;
+        return true;
+    }
+
+    inline size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    std::atomic<size_t> enqueue_position_{0};
+    // Only touched by the consumer
+    size_t dequeue_position_ = 0;
+};
+
+#endif // MPSC_QUEUE_H
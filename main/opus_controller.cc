@@ -0,0 +1,91 @@
+#include "opus_controller.h"
+
+#include <esp_log.h>
+
+#define TAG "OpusController"
+
+void OpusController::Reset(int max_complexity, int frame_duration_ms) {
+    max_complexity_ = max_complexity;
+    frame_duration_ms_ = frame_duration_ms;
+    settings_.complexity = max_complexity;
+    settings_.frame_duration_ms = frame_duration_ms;
+    encode_us_ = 0;
+    encode_frames_ = 0;
+    encode_load_ = 0;
+    cpu_bad_samples_ = 0;
+    network_bad_samples_ = 0;
+    good_samples_ = 0;
+}
+
+void OpusController::SetFrameDuration(int frame_duration_ms) {
+    if (settings_.frame_duration_ms == frame_duration_ms_) {
+        settings_.frame_duration_ms = frame_duration_ms;
+    }
+    frame_duration_ms_ = frame_duration_ms;
+}
+
+void OpusController::RecordEncode(uint32_t elapsed_us, uint32_t frames) {
+    encode_us_.fetch_add(elapsed_us, std::memory_order_relaxed);
+    encode_frames_.fetch_add(frames, std::memory_order_relaxed);
+}
+
+bool OpusController::Update(const OpusControllerInput& input) {
+    uint32_t elapsed_us = encode_us_.exchange(0, std::memory_order_relaxed);
+    uint32_t frames = encode_frames_.exchange(0, std::memory_order_relaxed);
+    if (frames > 0 && input.encoder_frame_duration_ms > 0) {
+        encode_load_ = elapsed_us / frames / 10 / input.encoder_frame_duration_ms;
+    }
+
+    bool cpu_bad = encode_load_ >= OPUS_CONTROLLER_LOAD_HIGH || input.encode_backlog >= OPUS_CONTROLLER_BACKLOG_FRAMES;
+    bool network_bad = input.send_backlog >= OPUS_CONTROLLER_BACKLOG_FRAMES || (input.probes > 0 &&
+        (input.loss_percent >= OPUS_CONTROLLER_LOSS_PERCENT || input.rtt_ms >= OPUS_CONTROLLER_RTT_MS));
+    bool changed = false;
+
+    if (cpu_bad) {
+        if (++cpu_bad_samples_ >= OPUS_CONTROLLER_DEGRADE_SAMPLES && settings_.complexity > 0) {
+            cpu_bad_samples_ = 0;
+            settings_.complexity--;
+            ESP_LOGI(TAG, "Encode load %lu%%, backlog %zu frames: complexity down to %d",
+                encode_load_, input.encode_backlog, settings_.complexity);
+            changed = true;
+        }
+    } else {
+        cpu_bad_samples_ = 0;
+    }
+
+    if (network_bad) {
+        if (++network_bad_samples_ >= OPUS_CONTROLLER_DEGRADE_SAMPLES &&
+            settings_.frame_duration_ms < OPUS_CONTROLLER_WEAK_FRAME_DURATION_MS) {
+            network_bad_samples_ = 0;
+            settings_.frame_duration_ms = OPUS_CONTROLLER_WEAK_FRAME_DURATION_MS;
+            ESP_LOGI(TAG, "Send backlog %zu, loss %lu%%, rtt %lu ms: frame duration up to %d ms for the next channel",
+                input.send_backlog, input.loss_percent, input.rtt_ms, settings_.frame_duration_ms);
+            changed = true;
+        }
+    } else {
+        network_bad_samples_ = 0;
+    }
+
+    // Between the two load thresholds nothing changes, and nothing counts toward recovery
+    bool good = !cpu_bad && !network_bad && encode_load_ < OPUS_CONTROLLER_LOAD_LOW &&
+        input.encode_backlog == 0 && input.send_backlog == 0;
+    if (!good) {
+        good_samples_ = 0;
+    } else if (++good_samples_ >= OPUS_CONTROLLER_RECOVER_SAMPLES) {
+        good_samples_ = 0;
+        if (settings_.frame_duration_ms != frame_duration_ms_) {
+            settings_.frame_duration_ms = frame_duration_ms_;
+            ESP_LOGI(TAG, "Network recovered: frame duration back to %d ms for the next channel", frame_duration_ms_);
+            changed = true;
+        } else if (settings_.complexity < max_complexity_) {
+            settings_.complexity++;
+            ESP_LOGI(TAG, "Encode load %lu%%: complexity up to %d", encode_load_, settings_.complexity);
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        decisions_++;
+    }
+    return changed;
+}
@@ -0,0 +1,70 @@
+#ifndef OPUS_CONTROLLER_H
+#define OPUS_CONTROLLER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Degrade after this many bad samples in a row, recover after this many good ones
+#define OPUS_CONTROLLER_DEGRADE_SAMPLES 2
+#define OPUS_CONTROLLER_RECOVER_SAMPLES 10
+// Encode time per frame as a percentage of the frame duration
+#define OPUS_CONTROLLER_LOAD_HIGH 60
+#define OPUS_CONTROLLER_LOAD_LOW 30
+// Frames waiting for the encoder, or encoded packets waiting to be sent
+#define OPUS_CONTROLLER_BACKLOG_FRAMES 4
+#define OPUS_CONTROLLER_LOSS_PERCENT 10
+#define OPUS_CONTROLLER_RTT_MS 800
+// Frame duration proposed for the next audio channel while the network is weak
+#define OPUS_CONTROLLER_WEAK_FRAME_DURATION_MS 60
+
+struct OpusControllerInput {
+    int encoder_frame_duration_ms = 0;
+    size_t encode_backlog = 0;
+    size_t send_backlog = 0;
+    // Only used if probes > 0
+    uint32_t loss_percent = 0;
+    uint32_t rtt_ms = 0;
+    uint32_t probes = 0;
+};
+
+struct OpusEncoderSettings {
+    int complexity = 0;
+    // Proposed to the server when the next audio channel opens
+    int frame_duration_ms = 0;
+};
+
+// Adjusts the encoder settings once per second from the encode time and the
+// network feedback. Encode time is recorded from the encoder task, Update() is
+// called from the main loop and returns true if the settings should be applied.
+// A busy CPU lowers the complexity one step at a time. A weak network proposes
+// longer frames for the next audio channel, which sends fewer and larger packets.
+// Recovery is one step per OPUS_CONTROLLER_RECOVER_SAMPLES good samples.
+class OpusController {
+public:
+    void Reset(int max_complexity, int frame_duration_ms);
+    // The frame duration requested by the user, proposed again once the network recovers
+    void SetFrameDuration(int frame_duration_ms);
+    void RecordEncode(uint32_t elapsed_us, uint32_t frames);
+    bool Update(const OpusControllerInput& input);
+
+    inline const OpusEncoderSettings& settings() const { return settings_; }
+    inline uint32_t encode_load() const { return encode_load_; }
+    inline uint32_t decisions() const { return decisions_; }
+
+private:
+    int max_complexity_ = 0;
+    int frame_duration_ms_ = 0;
+    OpusEncoderSettings settings_;
+
+    std::atomic<uint32_t> encode_us_{0};
+    std::atomic<uint32_t> encode_frames_{0};
+    uint32_t encode_load_ = 0;
+
+    int cpu_bad_samples_ = 0;
+    int network_bad_samples_ = 0;
+    int good_samples_ = 0;
+    uint32_t decisions_ = 0;
+};
+
+#endif // OPUS_CONTROLLER_H
@@ -0,0 +1,262 @@
+#include "cbor.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <cstring>
+
+#define TAG "Cbor"
+
+#define CBOR_MAX_DEPTH 16
+
+enum CborMajorType {
+    kCborUnsigned = 0,
+    kCborNegative = 1,
+    kCborByteString = 2,
+    kCborTextString = 3,
+    kCborArray = 4,
+    kCborMap = 5,
+    kCborTag = 6,
+    kCborSimple = 7,
+};
+
+static void EncodeHead(std::string& output, int major_type, uint64_t value) {
+    uint8_t type = major_type << 5;
+    if (value < 24) {
+        output.push_back(type | value);
+    } else if (value <= 0xFF) {
+        output.push_back(type | 24);
+        output.push_back(value);
+    } else if (value <= 0xFFFF) {
+        output.push_back(type | 25);
+        output.push_back(value >> 8);
+        output.push_back(value);
+    } else if (value <= 0xFFFFFFFF) {
+        output.push_back(type | 26);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            output.push_back(value >> shift);
+        }
+    } else {
+        output.push_back(type | 27);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            output.push_back(value >> shift);
+        }
+    }
+}
+
+static void EncodeText(std::string& output, const char* text) {
+    size_t length = strlen(text);
+    EncodeHead(output, kCborTextString, length);
+    output.append(text, length);
+}
+
+static void EncodeNumber(std::string& output, double number) {
+    // Integers are the common case and take 1 to 5 bytes
+    if (std::floor(number) == number && std::fabs(number) < 9007199254740992.0) {
+        if (number >= 0) {
+            EncodeHead(output, kCborUnsigned, (uint64_t)number);
+        } else {
+            EncodeHead(output, kCborNegative, (uint64_t)(-1 - (int64_t)number));
+        }
+        return;
+    }
+
+    float single = (float)number;
+    if ((double)single == number) {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        output.push_back(0xFA);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            output.push_back(bits >> shift);
+        }
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        output.push_back(0xFB);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            output.push_back(bits >> shift);
+        }
+    }
+}
+
+static bool EncodeItem(std::string& output, const cJSON* item, int depth) {
+    if (depth > CBOR_MAX_DEPTH) {
+        return false;
+    }
+    if (cJSON_IsFalse(item)) {
+        output.push_back(0xF4);
+    } else if (cJSON_IsTrue(item)) {
+        output.push_back(0xF5);
+    } else if (cJSON_IsNull(item)) {
+        output.push_back(0xF6);
+    } else if (cJSON_IsNumber(item)) {
+        EncodeNumber(output, item->valuedouble);
+    } else if (cJSON_IsString(item)) {
+        EncodeText(output, item->valuestring);
+    } else if (cJSON_IsArray(item) || cJSON_IsObject(item)) {
+        bool is_object = cJSON_IsObject(item);
+        EncodeHead(output, is_object ? kCborMap : kCborArray, cJSON_GetArraySize(item));
+        for (auto child = item->child; child != nullptr; child = child->next) {
+            if (is_object) {
+                EncodeText(output, child->string);
+            }
+            if (!EncodeItem(output, child, depth + 1)) {
+                return false;
+            }
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool CborEncode(const cJSON* root, std::string& output) {
+    output.clear();
+    return EncodeItem(output, root, 0);
+}
+
+class CborReader {
+public:
+    CborReader(const uint8_t* data, size_t size) : data_(data), end_(data + size) {}
+
+    bool at_end() const { return data_ == end_; }
+
+    cJSON* ReadItem(int depth) {
+        int major_type;
+        int info;
+        uint64_t value;
+        if (depth > CBOR_MAX_DEPTH || !ReadHead(major_type, info, value)) {
+            return nullptr;
+        }
+
+        switch (major_type) {
+        case kCborUnsigned:
+            return cJSON_CreateNumber((double)value);
+        case kCborNegative:
+            return cJSON_CreateNumber(-1.0 - (double)value);
+        case kCborTextString: {
+            if (value > (uint64_t)(end_ - data_)) {
+                return nullptr;
+            }
+            std::string text((const char*)data_, value);
+            data_ += value;
+            return cJSON_CreateString(text.c_str());
+        }
+        case kCborArray: {
+            auto array = cJSON_CreateArray();
+            for (uint64_t i = 0; i < value; i++) {
+                auto child = ReadItem(depth + 1);
+                if (child == nullptr) {
+                    cJSON_Delete(array);
+                    return nullptr;
+                }
+                cJSON_AddItemToArray(array, child);
+            }
+            return array;
+        }
+        case kCborMap: {
+            auto object = cJSON_CreateObject();
+            for (uint64_t i = 0; i < value; i++) {
+                auto key = ReadItem(depth + 1);
+                if (key == nullptr || !cJSON_IsString(key)) {
+                    cJSON_Delete(key);
+                    cJSON_Delete(object);
+                    return nullptr;
+                }
+                auto child = ReadItem(depth + 1);
+                if (child == nullptr) {
+                    cJSON_Delete(key);
+                    cJSON_Delete(object);
+                    return nullptr;
+                }
+                cJSON_AddItemToObject(object, key->valuestring, child);
+                cJSON_Delete(key);
+            }
+            return object;
+        }
+        case kCborSimple:
+            return ReadSimple(info, value);
+        default:
+            // Byte strings and tags have no JSON counterpart
+            ESP_LOGW(TAG, "Unsupported major type %d", major_type);
+            return nullptr;
+        }
+    }
+
+private:
+    const uint8_t* data_;
+    const uint8_t* end_;
+
+    bool ReadHead(int& major_type, int& info, uint64_t& value) {
+        if (data_ == end_) {
+            return false;
+        }
+        major_type = *data_ >> 5;
+        info = *data_ & 0x1F;
+        data_++;
+        if (info < 24) {
+            value = info;
+            return true;
+        }
+        if (info > 27) {
+            // Indefinite lengths are not used by the server
+            return false;
+        }
+        size_t bytes = 1 << (info - 24);
+        if (bytes > (size_t)(end_ - data_)) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < bytes; i++) {
+            value = (value << 8) | *data_++;
+        }
+        return true;
+    }
+
+    cJSON* ReadSimple(int info, uint64_t value) {
+        switch (info) {
+        case 20:
+            return cJSON_CreateFalse();
+        case 21:
+            return cJSON_CreateTrue();
+        case 22:
+        case 23:
+            return cJSON_CreateNull();
+        case 25: {
+            // Half precision, see RFC 8949 appendix D
+            int exponent = (value >> 10) & 0x1F;
+            double mantissa = value & 0x3FF;
+            double number;
+            if (exponent == 0) {
+                number = std::ldexp(mantissa, -24);
+            } else if (exponent != 31) {
+                number = std::ldexp(mantissa + 1024, exponent - 25);
+            } else {
+                number = mantissa == 0 ? INFINITY : NAN;
+            }
+            return cJSON_CreateNumber(value & 0x8000 ? -number : number);
+        }
+        case 26: {
+            uint32_t bits = value;
+            float number;
+            memcpy(&number, &bits, sizeof(number));
+            return cJSON_CreateNumber(number);
+        }
+        case 27: {
+            double number;
+            memcpy(&number, &value, sizeof(number));
+            return cJSON_CreateNumber(number);
+        }
+        default:
+            return nullptr;
+        }
+    }
+};
+
+cJSON* CborDecode(const char* data, size_t size) {
+    CborReader reader((const uint8_t*)data, size);
+    auto root = reader.ReadItem(0);
+    if (root != nullptr && !reader.at_end()) {
+        ESP_LOGW(TAG, "Trailing bytes after CBOR message");
+    }
+    return root;
+}
@@ -0,0 +1,23 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <cJSON.h>
+#include <string>
+#include <cstdint>
+
+// A small RFC 8949 codec for control messages, mapping to and from cJSON trees
+// so that the message handlers do not care which encoding was on the wire.
+// Only what JSON can express is supported: integers, floats, text strings,
+// arrays, maps with text keys, booleans and null, all with definite lengths.
+
+// Returns false if the tree holds something that cannot be encoded
+bool CborEncode(const cJSON* root, std::string& output);
+// Returns nullptr on malformed or unsupported input, free with cJSON_Delete
+cJSON* CborDecode(const char* data, size_t size);
+
+// A CBOR map starts with major type 5, a JSON object with '{'
+inline bool IsCborMessage(const char* data, size_t size) {
+    return size > 0 && ((uint8_t)data[0] & 0xE0) == 0xA0;
+}
+
+#endif // CBOR_H
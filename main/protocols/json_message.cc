@@ -0,0 +1,257 @@
+#include "json_message.h"
+
+#include <cstring>
+#include <cstdlib>
+
+#define JSON_MESSAGE_MAX_DEPTH 16
+
+bool JsonMessage::Parse(const char* data, size_t length) {
+    pos_ = data;
+    end_ = data + length;
+    arena_used_ = 0;
+    field_count_ = 0;
+    has_nested_ = false;
+
+    SkipSpaces();
+    if (pos_ == end_ || *pos_ != '{') {
+        return false;
+    }
+    pos_++;
+    SkipSpaces();
+    if (pos_ != end_ && *pos_ == '}') {
+        return true;
+    }
+
+    while (true) {
+        SkipSpaces();
+        if (field_count_ >= JSON_MESSAGE_MAX_FIELDS || pos_ == end_ || *pos_ != '"') {
+            return false;
+        }
+        auto& field = fields_[field_count_];
+        field.key = ReadString();
+        if (field.key == nullptr) {
+            return false;
+        }
+        SkipSpaces();
+        if (pos_ == end_ || *pos_ != ':') {
+            return false;
+        }
+        pos_++;
+        SkipSpaces();
+        if (pos_ == end_) {
+            return false;
+        }
+
+        if (*pos_ == '"') {
+            field.kind = kJsonValueString;
+            field.value = ReadString();
+        } else if (*pos_ == '{' || *pos_ == '[') {
+            field.kind = kJsonValueNested;
+            field.value = "";
+            has_nested_ = true;
+            if (!SkipNested()) {
+                return false;
+            }
+        } else {
+            field.value = ReadLiteral(field.kind);
+        }
+        if (field.value == nullptr) {
+            return false;
+        }
+        field_count_++;
+
+        SkipSpaces();
+        if (pos_ == end_) {
+            return false;
+        }
+        if (*pos_ == '}') {
+            return true;
+        }
+        if (*pos_ != ',') {
+            return false;
+        }
+        pos_++;
+    }
+}
+
+const char* JsonMessage::GetString(const char* key) const {
+    for (int i = 0; i < field_count_; i++) {
+        if (fields_[i].kind == kJsonValueString && strcmp(fields_[i].key, key) == 0) {
+            return fields_[i].value;
+        }
+    }
+    return nullptr;
+}
+
+bool JsonMessage::GetInt(const char* key, int& value) const {
+    for (int i = 0; i < field_count_; i++) {
+        if (fields_[i].kind == kJsonValueNumber && strcmp(fields_[i].key, key) == 0) {
+            value = strtol(fields_[i].value, nullptr, 10);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JsonMessage::SkipSpaces() {
+    while (pos_ != end_ && (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n' || *pos_ == '\r')) {
+        pos_++;
+    }
+}
+
+bool JsonMessage::PutChar(char c) {
+    if (arena_used_ >= sizeof(arena_)) {
+        return false;
+    }
+    arena_[arena_used_++] = c;
+    return true;
+}
+
+bool JsonMessage::PutUtf8(uint32_t code_point) {
+    if (code_point < 0x80) {
+        return PutChar(code_point);
+    } else if (code_point < 0x800) {
+        return PutChar(0xC0 | (code_point >> 6)) && PutChar(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        return PutChar(0xE0 | (code_point >> 12)) && PutChar(0x80 | ((code_point >> 6) & 0x3F)) &&
+            PutChar(0x80 | (code_point & 0x3F));
+    }
+    return PutChar(0xF0 | (code_point >> 18)) && PutChar(0x80 | ((code_point >> 12) & 0x3F)) &&
+        PutChar(0x80 | ((code_point >> 6) & 0x3F)) && PutChar(0x80 | (code_point & 0x3F));
+}
+
+bool JsonMessage::ReadHex4(uint32_t& value) {
+    if (end_ - pos_ < 4) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *pos_++;
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Unescapes the string at pos_ into the arena and returns it, nul terminated
+const char* JsonMessage::ReadString() {
+    const char* start = arena_ + arena_used_;
+    pos_++;
+    while (pos_ != end_) {
+        char c = *pos_++;
+        if (c == '"') {
+            return PutChar('\0') ? start : nullptr;
+        }
+        if (c != '\\') {
+            if (!PutChar(c)) {
+                return nullptr;
+            }
+            continue;
+        }
+        if (pos_ == end_) {
+            return nullptr;
+        }
+        char escape = *pos_++;
+        bool ok;
+        switch (escape) {
+        case '"': ok = PutChar('"'); break;
+        case '\\': ok = PutChar('\\'); break;
+        case '/': ok = PutChar('/'); break;
+        case 'b': ok = PutChar('\b'); break;
+        case 'f': ok = PutChar('\f'); break;
+        case 'n': ok = PutChar('\n'); break;
+        case 'r': ok = PutChar('\r'); break;
+        case 't': ok = PutChar('\t'); break;
+        case 'u': {
+            uint32_t code_point;
+            if (!ReadHex4(code_point)) {
+                return nullptr;
+            }
+            // Characters outside the BMP come as a surrogate pair
+            if (code_point >= 0xD800 && code_point < 0xDC00) {
+                uint32_t low;
+                if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u') {
+                    return nullptr;
+                }
+                pos_ += 2;
+                if (!ReadHex4(low) || low < 0xDC00 || low >= 0xE000) {
+                    return nullptr;
+                }
+                code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+            }
+            ok = PutUtf8(code_point);
+            break;
+        }
+        default:
+            return nullptr;
+        }
+        if (!ok) {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// Numbers, true, false and null are kept as their literal text
+const char* JsonMessage::ReadLiteral(JsonValueKind& kind) {
+    const char* start = arena_ + arena_used_;
+    const char* literal = pos_;
+    while (pos_ != end_ && *pos_ != ',' && *pos_ != '}' && *pos_ != ' ' && *pos_ != '\t' &&
+        *pos_ != '\n' && *pos_ != '\r') {
+        if (!PutChar(*pos_++)) {
+            return nullptr;
+        }
+    }
+    size_t length = pos_ - literal;
+    if (length == 0 || !PutChar('\0')) {
+        return nullptr;
+    }
+    if (strcmp(start, "true") == 0 || strcmp(start, "false") == 0) {
+        kind = kJsonValueBool;
+    } else if (strcmp(start, "null") == 0) {
+        kind = kJsonValueNull;
+    } else if (*literal == '-' || (*literal >= '0' && *literal <= '9')) {
+        kind = kJsonValueNumber;
+    } else {
+        return nullptr;
+    }
+    return start;
+}
+
+// Objects and arrays only need to be skipped, strings inside them are not unescaped
+bool JsonMessage::SkipNested() {
+    int depth = 0;
+    bool in_string = false;
+    while (pos_ != end_) {
+        char c = *pos_++;
+        if (in_string) {
+            if (c == '\\') {
+                if (pos_ == end_) {
+                    return false;
+                }
+                pos_++;
+            } else if (c == '"') {
+                in_string = false;
+            }
+        } else if (c == '"') {
+            in_string = true;
+        } else if (c == '{' || c == '[') {
+            if (++depth > JSON_MESSAGE_MAX_DEPTH) {
+                return false;
+            }
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
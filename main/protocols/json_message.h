@@ -0,0 +1,60 @@
+#ifndef JSON_MESSAGE_H
+#define JSON_MESSAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define JSON_MESSAGE_ARENA_SIZE 1024
+#define JSON_MESSAGE_MAX_FIELDS 16
+
+enum JsonValueKind : uint8_t {
+    kJsonValueString,
+    kJsonValueNumber,
+    kJsonValueBool,
+    kJsonValueNull,
+    // Objects and arrays are skipped, the value is empty
+    kJsonValueNested,
+};
+
+// Tokenizes a flat server message in one pass, without touching the heap.
+// Only the top level fields are kept: keys and unescaped scalar values are
+// written into a fixed arena owned by the object, so the results are valid
+// until the next Parse(). Parse() fails on malformed input or if the message
+// does not fit, and the caller is expected to fall back to cJSON then.
+class JsonMessage {
+public:
+    bool Parse(const char* data, size_t length);
+
+    // nullptr if the field is missing or not a string
+    const char* GetString(const char* key) const;
+    // false if the field is missing or not a number
+    bool GetInt(const char* key, int& value) const;
+    bool has_nested() const { return has_nested_; }
+    int field_count() const { return field_count_; }
+
+private:
+    struct Field {
+        const char* key;
+        const char* value;
+        JsonValueKind kind;
+    };
+
+    char arena_[JSON_MESSAGE_ARENA_SIZE];
+    size_t arena_used_ = 0;
+    Field fields_[JSON_MESSAGE_MAX_FIELDS];
+    int field_count_ = 0;
+    bool has_nested_ = false;
+
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
+
+    void SkipSpaces();
+    const char* ReadString();
+    const char* ReadLiteral(JsonValueKind& kind);
+    bool SkipNested();
+    bool PutChar(char c);
+    bool PutUtf8(uint32_t code_point);
+    bool ReadHex4(uint32_t& value);
+};
+
+#endif // JSON_MESSAGE_H
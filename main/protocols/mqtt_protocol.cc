@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "cbor.h"
 
 #include <esp_log.h>
 #include <ml307_mqtt.h>
@@ -24,6 +25,9 @@ MqttProtocol::~MqttProtocol() {
     if (mqtt_ != nullptr) {
         delete mqtt_;
     }
+    if (aes_initialized_) {
+        mbedtls_aes_free(&aes_ctx_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -60,10 +64,22 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
-            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+        cJSON* root;
+        if (IsCborMessage(payload.data(), payload.size())) {
+            root = CborDecode(payload.data(), payload.size());
+            if (root == nullptr) {
+                ESP_LOGE(TAG, "Failed to decode cbor message of %zu bytes", payload.size());
+                return;
+            }
+        } else if (DispatchIncomingMessage(payload.data(), payload.size())) {
+            last_incoming_time_ = std::chrono::steady_clock::now();
             return;
+        } else {
+            root = cJSON_Parse(payload.c_str());
+            if (root == nullptr) {
+                ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+                return;
+            }
         }
         cJSON* type = cJSON_GetObjectItem(root, "type");
         if (type == nullptr) {
@@ -77,11 +93,26 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         } else if (strcmp(type->valuestring, "goodbye") == 0) {
             auto session_id = cJSON_GetObjectItem(root, "session_id");
             ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+            if (resuming_) {
+                // The server no longer knows the session, OpenAudioChannel falls back to hello
+                xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_RESUME_REJECTED_EVENT);
+            } else if (session_id == nullptr || session_id_ == session_id->valuestring) {
                 Application::GetInstance().Schedule([this]() {
+                    // The server ended the session, it cannot be resumed
+                    resume_ticket_.clear();
                     CloseAudioChannel();
                 });
             }
+        } else if (strcmp(type->valuestring, "resume") == 0) {
+            auto session_id = cJSON_GetObjectItem(root, "session_id");
+            if (resuming_ && (session_id == nullptr || session_id_ == session_id->valuestring)) {
+                xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_RESUMED_EVENT);
+            }
+        } else if (strcmp(type->valuestring, "pong") == 0) {
+            auto id = cJSON_GetObjectItem(root, "id");
+            if (cJSON_IsNumber(id)) {
+                HandlePong(id->valueint);
+            }
         } else if (on_incoming_json_ != nullptr) {
             on_incoming_json_(root);
         }
@@ -110,42 +141,77 @@ void MqttProtocol::SendText(const std::string& text) {
     }
 }
 
-void MqttProtocol::SendAudio(const std::vector<uint8_t>& data) {
+void MqttProtocol::SendCbor(const std::string& data) {
+    if (publish_topic_.empty()) {
+        return;
+    }
+    if (!mqtt_->Publish(publish_topic_, data)) {
+        ESP_LOGE(TAG, "Failed to publish cbor message of %zu bytes", data.size());
+        SetError(Lang::Strings::SERVER_ERROR);
+    }
+}
+
+void MqttProtocol::SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
-    if (udp_ == nullptr) {
+    if (udp_ == nullptr || suspended_) {
         return;
     }
 
-    std::string nonce(aes_nonce_);
+    // The header is the nonce with the size and sequence filled in, it is also the initial counter
+    uint8_t nonce[16];
+    memcpy(nonce, aes_nonce_.data(), sizeof(nonce));
     *(uint16_t*)&nonce[2] = htons(data.size());
     *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
 
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + data.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    send_buffer_.resize(sizeof(nonce) + data.size());
+    auto buffer = (uint8_t*)send_buffer_.data();
+    memcpy(buffer, nonce, sizeof(nonce));
 
+    // mbedtls uses the AES peripheral, with DMA for larger blocks, when CONFIG_MBEDTLS_HARDWARE_AES is set
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)data.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, nonce, stream_block,
+        data.data(), buffer + sizeof(nonce)) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return;
     }
-    udp_->Send(encrypted);
+    udp_->Send(send_buffer_);
+}
+
+void MqttProtocol::ReleaseUdp() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ != nullptr) {
+        delete udp_;
+        udp_ = nullptr;
+    }
+    suspended_ = false;
+}
+
+bool MqttProtocol::CanResume() const {
+    if (resume_ticket_.empty() || udp_ == nullptr || error_occurred_) {
+        return false;
+    }
+    // A new frame duration has to be negotiated with a full hello
+    return requested_frame_duration_ == hello_frame_duration_;
 }
 
 void MqttProtocol::CloseAudioChannel() {
-    {
+    bool resumable = CanResume();
+    if (resumable) {
+        // Keep the socket, the key and both sequence counters for the next turn
         std::lock_guard<std::mutex> lock(channel_mutex_);
-        if (udp_ != nullptr) {
-            delete udp_;
-            udp_ = nullptr;
-        }
+        suspended_ = true;
+        resume_deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(resume_ttl_seconds_);
+    } else {
+        ReleaseUdp();
     }
 
     std::string message = "{";
     message += "\"session_id\":\"" + session_id_ + "\",";
     message += "\"type\":\"goodbye\"";
+    if (resumable) {
+        message += ",\"resume\":true";
+    }
     message += "}";
     SendText(message);
 
@@ -154,14 +220,56 @@ void MqttProtocol::CloseAudioChannel() {
     }
 }
 
+bool MqttProtocol::ResumeAudioChannel() {
+    ESP_LOGI(TAG, "Resuming session %s", session_id_.c_str());
+    std::string message = "{";
+    message += "\"session_id\":\"" + session_id_ + "\",";
+    message += "\"type\":\"resume\",";
+    message += "\"ticket\":\"" + resume_ticket_ + "\"";
+    message += "}";
+    xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_RESUMED_EVENT | MQTT_PROTOCOL_RESUME_REJECTED_EVENT);
+    resuming_ = true;
+    SendText(message);
+    if (error_occurred_) {
+        resuming_ = false;
+        return false;
+    }
+
+    // The server echoes the resume, or answers with goodbye if it no longer knows the session
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_,
+        MQTT_PROTOCOL_RESUMED_EVENT | MQTT_PROTOCOL_RESUME_REJECTED_EVENT, pdTRUE, pdFALSE,
+        pdMS_TO_TICKS(MQTT_PROTOCOL_RESUME_TIMEOUT_MS));
+    resuming_ = false;
+    if (!(bits & MQTT_PROTOCOL_RESUMED_EVENT)) {
+        ESP_LOGW(TAG, "Session %s not resumed (%s), sending hello", session_id_.c_str(),
+            (bits & MQTT_PROTOCOL_RESUME_REJECTED_EVENT) ? "rejected" : "timeout");
+        resume_ticket_.clear();
+        return false;
+    }
+
+    suspended_ = false;
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    NotifyAudioChannelOpened();
+    return true;
+}
+
 bool MqttProtocol::OpenAudioChannel() {
     if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
+        // The server drops the session together with the MQTT connection
+        ReleaseUdp();
         if (!StartMqttClient(true)) {
             return false;
         }
     }
 
+    if (suspended_) {
+        if (CanResume() && std::chrono::steady_clock::now() < resume_deadline_ && ResumeAudioChannel()) {
+            return true;
+        }
+        ReleaseUdp();
+    }
+
     error_occurred_ = false;
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
@@ -171,9 +279,9 @@ bool MqttProtocol::OpenAudioChannel() {
     message += "\"type\":\"hello\",";
     message += "\"version\": 3,";
     message += "\"transport\":\"udp\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
+    message += GetHelloAudioParams();
+    message += GetHelloFeatures();
+    message += "}";
     SendText(message);
 
     // 等待服务器响应
@@ -190,7 +298,7 @@ bool MqttProtocol::OpenAudioChannel() {
     }
     udp_ = Board::GetInstance().CreateUdp();
     udp_->OnMessage([this](const std::string& data) {
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < aes_nonce_.size()) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
             return;
         }
@@ -198,39 +306,46 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
-        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        if (suspended_) {
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
+        // Out of order packets are passed on, the jitter buffer reorders them or drops them if too late
+        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
+        if (sequence < remote_sequence_) {
+            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+        } else if (sequence != remote_sequence_ + 1) {
             ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
 
-        std::vector<uint8_t> decrypted;
         size_t decrypted_size = data.size() - aes_nonce_.size();
+        auto decrypted = AudioPacketPool::GetInstance().Acquire(decrypted_size);
+        if (decrypted.size() != decrypted_size) {
+            return;
+        }
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        decrypted.resize(decrypted_size);
-        auto nonce = (uint8_t*)data.data();
+        // The counter is advanced in place, so it cannot be the received buffer itself
+        uint8_t nonce[16];
+        memcpy(nonce, data.data(), sizeof(nonce));
         auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)decrypted.data());
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, decrypted.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
         }
+        decrypted.set_sequence(sequence);
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(decrypted));
         }
-        remote_sequence_ = sequence;
+        if (sequence > remote_sequence_) {
+            remote_sequence_ = sequence;
+        }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     udp_->Connect(udp_server_, udp_port_);
 
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
-    }
+    NotifyAudioChannelOpened();
     return true;
 }
 
@@ -247,12 +362,21 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
-    // Get sample rate from hello message
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (audio_params != NULL) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (sample_rate != NULL) {
-            server_sample_rate_ = sample_rate->valueint;
+    // Get sample rate and frame duration from hello message
+    ParseServerAudioParams(root);
+    ParseServerFeatures(root);
+    ParseServerDescriptorsHash(root);
+    hello_frame_duration_ = requested_frame_duration_;
+
+    resume_ticket_.clear();
+    auto resume = cJSON_GetObjectItem(root, "resume");
+    if (resume != nullptr) {
+        auto ticket = cJSON_GetObjectItem(resume, "ticket");
+        auto ttl = cJSON_GetObjectItem(resume, "ttl");
+        if (cJSON_IsString(ticket) && cJSON_IsNumber(ttl) && ttl->valueint > 0) {
+            resume_ticket_ = ticket->valuestring;
+            resume_ttl_seconds_ = ttl->valueint;
+            ESP_LOGI(TAG, "Session can be resumed within %d seconds after goodbye", resume_ttl_seconds_);
         }
     }
 
@@ -269,10 +393,20 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
     aes_nonce_ = DecodeHexString(nonce);
+    if (aes_nonce_.size() != 16) {
+        ESP_LOGE(TAG, "Invalid nonce size: %zu", aes_nonce_.size());
+        return;
+    }
+    // The context lives for the whole session, only the key schedule is redone on a new hello
+    if (aes_initialized_) {
+        mbedtls_aes_free(&aes_ctx_);
+    }
     mbedtls_aes_init(&aes_ctx_);
+    aes_initialized_ = true;
     mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
     local_sequence_ = 0;
     remote_sequence_ = 0;
+    ResetLinkQuality();
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -296,5 +430,5 @@ std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
 }
 
 bool MqttProtocol::IsAudioChannelOpened() const {
-    return udp_ != nullptr && !error_occurred_ && !IsTimeout();
+    return udp_ != nullptr && !suspended_ && !error_occurred_ && !IsTimeout();
 }
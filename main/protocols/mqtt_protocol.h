@@ -14,11 +14,17 @@
 #include <string>
 #include <map>
 #include <mutex>
+#include <chrono>
+#include <atomic>
 
 #define MQTT_PING_INTERVAL_SECONDS 90
 #define MQTT_RECONNECT_INTERVAL_MS 10000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define MQTT_PROTOCOL_RESUMED_EVENT (1 << 1)
+#define MQTT_PROTOCOL_RESUME_REJECTED_EVENT (1 << 2)
+// Without an answer in time the channel is opened with a full hello
+#define MQTT_PROTOCOL_RESUME_TIMEOUT_MS 3000
 
 class MqttProtocol : public Protocol {
 public:
@@ -26,7 +32,7 @@ public:
     ~MqttProtocol();
 
     void Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    void SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -44,17 +50,35 @@ private:
     Mqtt* mqtt_ = nullptr;
     Udp* udp_ = nullptr;
     mbedtls_aes_context aes_ctx_;
+    bool aes_initialized_ = false;
     std::string aes_nonce_;
+    // Nonce header and ciphertext of the packet being sent, reused so it is only grown once
+    std::string send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
 
+    // Advertised by the server in hello, lets the next turn reuse the UDP session
+    std::string resume_ticket_;
+    int resume_ttl_seconds_ = 0;
+    std::chrono::time_point<std::chrono::steady_clock> resume_deadline_;
+    int hello_frame_duration_ = 0;
+    // The channel is closed but the UDP socket and AES context are kept for a resume.
+    // Read by the UDP receive task.
+    std::atomic<bool> suspended_{false};
+    // A resume request is waiting for the server's answer
+    std::atomic<bool> resuming_{false};
+
     bool StartMqttClient(bool report_error=false);
+    bool CanResume() const;
+    bool ResumeAudioChannel();
+    void ReleaseUdp();
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
     void SendText(const std::string& text) override;
+    void SendCbor(const std::string& data) override;
 };
 
 
@@ -1,6 +1,9 @@
 #include "protocol.h"
+#include "cbor.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <cstring>
 
 #define TAG "Protocol"
 
@@ -8,7 +11,28 @@ void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback) {
+void Protocol::OnIncomingMessage(std::function<bool(const JsonMessage& message)> callback) {
+    on_incoming_message_ = callback;
+}
+
+bool Protocol::DispatchIncomingMessage(const char* data, size_t length) {
+#if CONFIG_PROTOCOL_STREAMING_JSON
+    if (!incoming_message_.Parse(data, length)) {
+        return false;
+    }
+    auto type = incoming_message_.GetString("type");
+    int id;
+    if (type != nullptr && strcmp(type, "pong") == 0 && incoming_message_.GetInt("id", id)) {
+        HandlePong(id);
+        return true;
+    }
+    return on_incoming_message_ != nullptr && on_incoming_message_(incoming_message_);
+#else
+    return false;
+#endif
+}
+
+void Protocol::OnIncomingAudio(std::function<void(AudioPacket&& packet)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -24,8 +48,134 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
     on_network_error_ = callback;
 }
 
+bool Protocol::OpenAudioChannelDeferred() {
+    defer_notifications_ = true;
+    bool opened = OpenAudioChannel();
+    defer_notifications_ = false;
+    return opened;
+}
+
+void Protocol::NotifyAudioChannelOpened() {
+    if (defer_notifications_) {
+        return;
+    }
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+}
+
+bool Protocol::IsValidFrameDuration(int frame_duration_ms) {
+    return frame_duration_ms == 20 || frame_duration_ms == 40 || frame_duration_ms == 60 || frame_duration_ms == 120;
+}
+
+void Protocol::SetFrameDuration(int frame_duration_ms) {
+    if (!IsValidFrameDuration(frame_duration_ms)) {
+        ESP_LOGE(TAG, "Invalid frame duration: %d", frame_duration_ms);
+        return;
+    }
+    requested_frame_duration_ = frame_duration_ms;
+}
+
+std::string Protocol::GetHelloAudioParams() const {
+    return "\"audio_params\":{\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" +
+        std::to_string(requested_frame_duration_) + "}";
+}
+
+void Protocol::ParseServerAudioParams(const cJSON* root) {
+    // A server that does not answer with a frame duration accepts ours
+    frame_duration_ = requested_frame_duration_;
+
+    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    if (audio_params == NULL) {
+        return;
+    }
+    auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
+    if (sample_rate != NULL) {
+        server_sample_rate_ = sample_rate->valueint;
+    }
+    auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+    if (frame_duration != NULL) {
+        if (IsValidFrameDuration(frame_duration->valueint)) {
+            frame_duration_ = frame_duration->valueint;
+        } else {
+            ESP_LOGW(TAG, "Server frame duration %d is not supported, keep %d", frame_duration->valueint, frame_duration_);
+        }
+    }
+}
+
+std::string Protocol::GetHelloFeatures() const {
+#if CONFIG_PROTOCOL_CBOR
+    return ",\"features\":{\"cbor\":true}";
+#else
+    return "";
+#endif
+}
+
+void Protocol::ParseServerFeatures(const cJSON* root) {
+    cbor_enabled_ = false;
+#if CONFIG_PROTOCOL_CBOR
+    auto features = cJSON_GetObjectItem(root, "features");
+    if (features != NULL) {
+        cbor_enabled_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "cbor"));
+    }
+    ESP_LOGI(TAG, "Control messages encoded as %s", cbor_enabled_ ? "CBOR" : "JSON");
+#endif
+}
+
+void Protocol::SendMessage(cJSON* root) {
+    if (cbor_enabled_) {
+        std::string data;
+        if (CborEncode(root, data)) {
+            SendCbor(data);
+            cJSON_Delete(root);
+            return;
+        }
+        ESP_LOGW(TAG, "Failed to encode CBOR message, sending JSON");
+    }
+    auto json_str = cJSON_PrintUnformatted(root);
+    if (json_str != nullptr) {
+        SendText(std::string(json_str));
+        cJSON_free(json_str);
+    }
+    cJSON_Delete(root);
+}
+
+// Messages are built as JSON text, a cJSON tree is only needed to encode CBOR
+void Protocol::SendJsonText(const std::string& json) {
+    if (!cbor_enabled_) {
+        SendText(json);
+        return;
+    }
+    auto root = cJSON_Parse(json.c_str());
+    if (root == nullptr) {
+        ESP_LOGE(TAG, "Failed to parse message: %s", json.c_str());
+        return;
+    }
+    SendMessage(root);
+}
+
+void Protocol::ParseServerDescriptorsHash(const cJSON* root) {
+    known_descriptors_hash_.clear();
+    auto iot = cJSON_GetObjectItem(root, "iot");
+    if (iot != NULL) {
+        auto hash = cJSON_GetObjectItem(iot, "descriptors_hash");
+        if (cJSON_IsString(hash)) {
+            known_descriptors_hash_ = hash->valuestring;
+        }
+    }
+}
+
+void Protocol::SendCbor(const std::string& data) {
+    ESP_LOGE(TAG, "CBOR is not supported by this transport");
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
+    if (defer_notifications_) {
+        // The owner opens the channel itself after a failed deferred open and reports that error
+        ESP_LOGW(TAG, "Deferred open failed: %s", message.c_str());
+        return;
+    }
     if (on_network_error_ != nullptr) {
         on_network_error_(message);
     }
@@ -37,13 +187,13 @@ void Protocol::SendAbortSpeaking(AbortReason reason) {
         message += ",\"reason\":\"wake_word_detected\"";
     }
     message += "}";
-    SendText(message);
+    SendJsonText(message);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
     std::string json = "{\"session_id\":\"" + session_id_ + 
                       "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    SendJsonText(json);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
@@ -57,62 +207,127 @@ void Protocol::SendStartListening(ListeningMode mode) {
         message += ",\"mode\":\"manual\"";
     }
     message += "}";
-    SendText(message);
+    SendJsonText(message);
 }
 
 void Protocol::SendStopListening() {
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    SendJsonText(message);
 }
 
-void Protocol::SendIotDescriptors(const std::string& descriptors) {
-    cJSON* root = cJSON_Parse(descriptors.c_str());
-    if (root == nullptr) {
-        ESP_LOGE(TAG, "Failed to parse IoT descriptors: %s", descriptors.c_str());
+void Protocol::SendIotDescriptors(const std::vector<std::string>& descriptors, const std::string& hash) {
+    if (!hash.empty() && hash == known_descriptors_hash_) {
+        ESP_LOGI(TAG, "IoT descriptors %s already known by the server", hash.c_str());
         return;
     }
 
-    if (!cJSON_IsArray(root)) {
-        ESP_LOGE(TAG, "IoT descriptors should be an array");
-        cJSON_Delete(root);
-        return;
+    size_t total_size = 0;
+    for (auto& descriptor : descriptors) {
+        total_size += descriptor.size() + 1;
     }
-
-    int arraySize = cJSON_GetArraySize(root);
-    for (int i = 0; i < arraySize; ++i) {
-        cJSON* descriptor = cJSON_GetArrayItem(root, i);
-        if (descriptor == nullptr) {
-            ESP_LOGE(TAG, "Failed to get IoT descriptor at index %d", i);
-            continue;
+    std::string header = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"descriptors_hash\":\"" + hash + "\",\"descriptors\":[";
+    if (total_size <= IOT_DESCRIPTORS_MESSAGE_SIZE) {
+        std::string message = header;
+        message.reserve(header.size() + total_size + 2);
+        for (size_t i = 0; i < descriptors.size(); i++) {
+            if (i > 0) {
+                message += ",";
+            }
+            message += descriptors[i];
         }
+        message += "]}";
+        SendJsonText(message);
+    } else {
+        for (auto& descriptor : descriptors) {
+            SendJsonText(header + descriptor + "]}");
+        }
+    }
+    known_descriptors_hash_ = hash;
+}
 
-        cJSON* messageRoot = cJSON_CreateObject();
-        cJSON_AddStringToObject(messageRoot, "session_id", session_id_.c_str());
-        cJSON_AddStringToObject(messageRoot, "type", "iot");
-        cJSON_AddBoolToObject(messageRoot, "update", true);
+void Protocol::SendIotStates(const std::string& states) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
+    SendJsonText(message);
+}
 
-        cJSON* descriptorArray = cJSON_CreateArray();
-        cJSON_AddItemToArray(descriptorArray, cJSON_Duplicate(descriptor, 1));
-        cJSON_AddItemToObject(messageRoot, "descriptors", descriptorArray);
+void Protocol::SendLatencyReport(const std::string& latency) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"telemetry\",\"latency\":" + latency + "}";
+    SendJsonText(message);
+}
 
-        char* message = cJSON_PrintUnformatted(messageRoot);
-        if (message == nullptr) {
-            ESP_LOGE(TAG, "Failed to print JSON message for IoT descriptor at index %d", i);
-            cJSON_Delete(messageRoot);
-            continue;
+void Protocol::SendPing() {
+    int id;
+    int64_t now = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(link_mutex_);
+        // Probes older than the timeout are lost, their slots are reused
+        for (auto& probe : link_probes_) {
+            if (probe.id != 0 && now - probe.send_time > LINK_PROBE_TIMEOUT_MS * 1000) {
+                probe.id = 0;
+                UpdateLoss(true);
+            }
         }
+        auto slot = &link_probes_[next_probe_id_ % LINK_PROBE_SLOTS];
+        if (slot->id != 0) {
+            UpdateLoss(true);
+        }
+        id = next_probe_id_++;
+        slot->id = id;
+        slot->send_time = now;
+        link_quality_.probes++;
+    }
+
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"ping\",\"id\":" + std::to_string(id) + "}";
+    SendJsonText(message);
+}
+
+void Protocol::HandlePong(int id) {
+    int64_t now = esp_timer_get_time();
+    if (id <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(link_mutex_);
+    auto& probe = link_probes_[id % LINK_PROBE_SLOTS];
+    if (probe.id != id) {
+        // Already counted as lost
+        return;
+    }
+    probe.id = 0;
+    link_quality_.pongs++;
+    UpdateLoss(false);
 
-        SendText(std::string(message));
-        cJSON_free(message);
-        cJSON_Delete(messageRoot);
+    int64_t rtt = now - probe.send_time;
+    if (link_quality_.pongs == 1) {
+        srtt_ = rtt;
+        rttvar_ = rtt / 2;
+    } else {
+        int64_t delta = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+        rttvar_ += (delta - rttvar_) / 4;
+        srtt_ += (rtt - srtt_) / 8;
     }
+    link_quality_.rtt_ms = srtt_ / 1000;
+    link_quality_.rtt_jitter_ms = rttvar_ / 1000;
+}
 
-    cJSON_Delete(root);
+void Protocol::UpdateLoss(bool lost) {
+    loss_ += ((lost ? 100000 : 0) - loss_) / 8;
+    link_quality_.loss_percent = loss_ / 1000;
 }
 
-void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
-    SendText(message);
+LinkQuality Protocol::link_quality() {
+    std::lock_guard<std::mutex> lock(link_mutex_);
+    return link_quality_;
+}
+
+void Protocol::ResetLinkQuality() {
+    std::lock_guard<std::mutex> lock(link_mutex_);
+    for (auto& probe : link_probes_) {
+        probe.id = 0;
+    }
+    link_quality_ = LinkQuality();
+    srtt_ = 0;
+    rttvar_ = 0;
+    loss_ = 0;
 }
 
 bool Protocol::IsTimeout() const {
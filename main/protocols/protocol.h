@@ -5,6 +5,35 @@
 #include <string>
 #include <functional>
 #include <chrono>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#include "audio_packet_pool.h"
+#include "json_message.h"
+
+#ifdef CONFIG_OPUS_FRAME_DURATION_MS
+#define OPUS_FRAME_DURATION_MS CONFIG_OPUS_FRAME_DURATION_MS
+#else
+#define OPUS_FRAME_DURATION_MS 60
+#endif
+
+#define LINK_PROBE_INTERVAL_SECONDS 5
+// A probe without a pong after this long counts as lost
+#define LINK_PROBE_TIMEOUT_MS 3000
+#define LINK_PROBE_SLOTS 4
+
+// Smoothed the way TCP does it (RFC 6298), loss is a moving average over the probes
+struct LinkQuality {
+    uint32_t rtt_ms = 0;
+    uint32_t rtt_jitter_ms = 0;
+    uint32_t loss_percent = 0;
+    uint32_t probes = 0;
+    uint32_t pongs = 0;
+};
+
+// Larger descriptor sets are sent one thing per message
+#define IOT_DESCRIPTORS_MESSAGE_SIZE 4096
 
 struct BinaryProtocol3 {
     uint8_t type;
@@ -13,6 +42,17 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+// Websocket audio frames once version 2 is agreed in hello, all fields in network byte order
+struct BinaryProtocol2 {
+    uint16_t version;
+    uint16_t type;              // 0: opus
+    uint32_t sequence;          // starts at 1 for every audio channel
+    uint32_t timestamp;         // capture time in ms, 0 if unknown
+    uint16_t frame_duration;    // ms
+    uint16_t payload_size;
+    uint8_t payload[];
+} __attribute__((packed));
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -34,40 +74,108 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // The duration agreed on in the last hello exchange
+    inline int frame_duration() const {
+        return frame_duration_;
+    }
+
+    // Proposed in the next hello, the server may answer with another one
+    void SetFrameDuration(int frame_duration_ms);
+    static bool IsValidFrameDuration(int frame_duration_ms);
 
-    void OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback);
+    void OnIncomingAudio(std::function<void(AudioPacket&& packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Tried before OnIncomingJson when CONFIG_PROTOCOL_STREAMING_JSON is set,
+    // return false to have the message parsed with cJSON and passed there instead
+    void OnIncomingMessage(std::function<bool(const JsonMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
 
     virtual void Start() = 0;
     virtual bool OpenAudioChannel() = 0;
+    // Opens the channel without calling the opened or network error callbacks, so it can
+    // run on another task. The owner calls NotifyAudioChannelOpened() from its own task.
+    bool OpenAudioChannelDeferred();
+    void NotifyAudioChannelOpened();
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual void SendAudio(const std::vector<uint8_t>& data) = 0;
+    // timestamp is the capture time in ms, sent by transports that have a field for it
+    virtual void SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
-    virtual void SendIotDescriptors(const std::string& descriptors);
+    // Skipped if the server reported the same hash in hello
+    virtual void SendIotDescriptors(const std::vector<std::string>& descriptors, const std::string& hash);
     virtual void SendIotStates(const std::string& states);
+    // latency is a JSON object, see LatencyTracer::GetJson()
+    void SendLatencyReport(const std::string& latency);
+    // Sends a ping that the server echoes as a pong, see CONFIG_LINK_QUALITY_PROBE
+    void SendPing();
+    LinkQuality link_quality();
+    void ResetLinkQuality();
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::vector<uint8_t>&& data)> on_incoming_audio_;
+    std::function<bool(const JsonMessage& message)> on_incoming_message_;
+    std::function<void(AudioPacket&& packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
 
     int server_sample_rate_ = 16000;
+    int requested_frame_duration_ = OPUS_FRAME_DURATION_MS;
+    int frame_duration_ = OPUS_FRAME_DURATION_MS;
     bool error_occurred_ = false;
+    std::atomic<bool> defer_notifications_{false};
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    // Agreed in the hello exchange, control messages are then sent as CBOR
+    bool cbor_enabled_ = false;
+    // Hash of the IoT descriptors the server already has for this device
+    std::string known_descriptors_hash_;
 
     virtual void SendText(const std::string& text) = 0;
+    // Only called once CBOR is agreed, so only transports that offer it implement it
+    virtual void SendCbor(const std::string& data);
+    std::string GetHelloAudioParams() const;
+    void ParseServerAudioParams(const cJSON* root);
+    // Empty unless CONFIG_PROTOCOL_CBOR, otherwise starts with a comma
+    std::string GetHelloFeatures() const;
+    void ParseServerFeatures(const cJSON* root);
+    void ParseServerDescriptorsHash(const cJSON* root);
+    // Sends a message already serialized as JSON, in the agreed encoding
+    void SendJsonText(const std::string& json);
+    // Sends and deletes the message in the agreed encoding
+    void SendMessage(cJSON* root);
+    // Returns true if the text message was handled by the streaming dispatcher
+    bool DispatchIncomingMessage(const char* data, size_t length);
+    void HandlePong(int id);
+
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+
+private:
+    struct LinkProbe {
+        int id = 0;
+        int64_t send_time = 0;
+    };
+    std::mutex link_mutex_;
+    LinkProbe link_probes_[LINK_PROBE_SLOTS];
+    int next_probe_id_ = 1;
+    LinkQuality link_quality_;
+    // Fixed point, 1000 is one millisecond or 100%
+    int64_t srtt_ = 0;
+    int64_t rttvar_ = 0;
+    int64_t loss_ = 0;
+
+    void UpdateLoss(bool lost);
+
+#if CONFIG_PROTOCOL_STREAMING_JSON
+    // Messages are received on one task per protocol, so one arena is enough
+    JsonMessage incoming_message_;
+#endif
 };
 
 #endif // PROTOCOL_H
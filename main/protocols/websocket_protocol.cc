@@ -25,12 +25,58 @@ WebsocketProtocol::~WebsocketProtocol() {
 void WebsocketProtocol::Start() {
 }
 
-void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data) {
+void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) {
     if (websocket_ == nullptr) {
         return;
     }
 
-    websocket_->Send(data.data(), data.size(), true);
+    if (version_ == 1) {
+        websocket_->Send(data.data(), data.size(), true);
+        return;
+    }
+
+    send_buffer_.resize(sizeof(BinaryProtocol2) + data.size());
+    auto packet = (BinaryProtocol2*)send_buffer_.data();
+    packet->version = htons(version_);
+    packet->type = 0;
+    packet->sequence = htonl(++local_sequence_);
+    packet->timestamp = htonl(timestamp);
+    packet->frame_duration = htons(frame_duration_);
+    packet->payload_size = htons(data.size());
+    memcpy(packet->payload, data.data(), data.size());
+    websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
+}
+
+void WebsocketProtocol::OnIncomingBinary(const char* data, size_t len) {
+    if (on_incoming_audio_ == nullptr) {
+        return;
+    }
+    if (version_ == 1) {
+        on_incoming_audio_(AudioPacketPool::GetInstance().Copy(data, len));
+        return;
+    }
+
+    auto packet = (const BinaryProtocol2*)data;
+    if (len < sizeof(BinaryProtocol2) || sizeof(BinaryProtocol2) + ntohs(packet->payload_size) > len) {
+        ESP_LOGE(TAG, "Invalid audio packet size: %zu", len);
+        return;
+    }
+    if (ntohs(packet->type) != 0) {
+        ESP_LOGW(TAG, "Unknown binary packet type: %u", ntohs(packet->type));
+        return;
+    }
+    // Out of order packets are passed on, the jitter buffer reorders them or drops them if too late
+    uint32_t sequence = ntohl(packet->sequence);
+    if (sequence != remote_sequence_ + 1) {
+        ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+    }
+    if ((int32_t)(sequence - remote_sequence_) > 0) {
+        remote_sequence_ = sequence;
+    }
+
+    auto audio = AudioPacketPool::GetInstance().Copy((const char*)packet->payload, ntohs(packet->payload_size));
+    audio.set_sequence(sequence);
+    on_incoming_audio_(std::move(audio));
 }
 
 void WebsocketProtocol::SendText(const std::string& text) {
@@ -63,24 +109,28 @@ bool WebsocketProtocol::OpenAudioChannel() {
     error_occurred_ = false;
     std::string url = CONFIG_WEBSOCKET_URL;
     std::string token = "Bearer " + std::string(CONFIG_WEBSOCKET_ACCESS_TOKEN);
+    std::string version = std::to_string(WEBSOCKET_PROTOCOL_VERSION);
     websocket_ = Board::GetInstance().CreateWebSocket();
     websocket_->SetHeader("Authorization", token.c_str());
-    websocket_->SetHeader("Protocol-Version", "1");
+    websocket_->SetHeader("Protocol-Version", version.c_str());
     websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
     websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                on_incoming_audio_(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
-            }
-        } else {
+            OnIncomingBinary(data, len);
+        } else if (!DispatchIncomingMessage(data, len)) {
             // Parse JSON data
             auto root = cJSON_Parse(data);
             auto type = cJSON_GetObjectItem(root, "type");
             if (type != NULL) {
                 if (strcmp(type->valuestring, "hello") == 0) {
                     ParseServerHello(root);
+                } else if (strcmp(type->valuestring, "pong") == 0) {
+                    auto id = cJSON_GetObjectItem(root, "id");
+                    if (cJSON_IsNumber(id)) {
+                        HandlePong(id->valueint);
+                    }
                 } else {
                     if (on_incoming_json_ != nullptr) {
                         on_incoming_json_(root);
@@ -108,14 +158,13 @@ bool WebsocketProtocol::OpenAudioChannel() {
     }
 
     // Send hello message to describe the client
-    // keys: message type, version, audio_params (format, sample_rate, channels)
+    // keys: message type, version, audio_params (format, sample_rate, channels, frame_duration)
     std::string message = "{";
     message += "\"type\":\"hello\",";
-    message += "\"version\": 1,";
+    message += "\"version\": " + version + ",";
     message += "\"transport\":\"websocket\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
+    message += GetHelloAudioParams();
+    message += "}";
     websocket_->Send(message);
 
     // Wait for server hello
@@ -126,9 +175,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
         return false;
     }
 
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
-    }
+    NotifyAudioChannelOpened();
 
     return true;
 }
@@ -140,13 +187,21 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         return;
     }
 
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (audio_params != NULL) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (sample_rate != NULL) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
+    ParseServerAudioParams(root);
+    ParseServerDescriptorsHash(root);
+
+    // A server that does not know version 2 answers with 1 or nothing
+    version_ = 1;
+#if CONFIG_WEBSOCKET_BINARY_PROTOCOL_V2
+    auto version = cJSON_GetObjectItem(root, "version");
+    if (cJSON_IsNumber(version) && version->valueint == 2) {
+        version_ = 2;
     }
+#endif
+    local_sequence_ = 0;
+    remote_sequence_ = 0;
+    ResetLinkQuality();
+    ESP_LOGI(TAG, "Binary protocol version %d", version_);
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
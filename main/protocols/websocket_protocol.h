@@ -9,6 +9,12 @@
 #include <freertos/event_groups.h>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+// Offered in the Protocol-Version header and the hello, the server may answer with 1
+#if CONFIG_WEBSOCKET_BINARY_PROTOCOL_V2
+#define WEBSOCKET_PROTOCOL_VERSION 2
+#else
+#define WEBSOCKET_PROTOCOL_VERSION 1
+#endif
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -16,7 +22,7 @@ public:
     ~WebsocketProtocol();
 
     void Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    void SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -24,8 +30,14 @@ public:
 private:
     EventGroupHandle_t event_group_handle_;
     WebSocket* websocket_ = nullptr;
+    // 1 sends bare opus frames, 2 adds a BinaryProtocol2 header
+    int version_ = 1;
+    uint32_t local_sequence_ = 0;
+    uint32_t remote_sequence_ = 0;
+    std::vector<uint8_t> send_buffer_;
 
     void ParseServerHello(const cJSON* root);
+    void OnIncomingBinary(const char* data, size_t len);
     void SendText(const std::string& text) override;
 };
 
@@ -0,0 +1,73 @@
+#include "scheduler.h"
+
+#include <esp_timer.h>
+
+void Scheduler::Push(std::function<void()>&& callback, SchedulePriority priority) {
+    auto& lane = lanes_[priority];
+    Task task{std::move(callback), esp_timer_get_time()};
+    lane.pending.fetch_add(1, std::memory_order_relaxed);
+
+    // Once a lane has overflowed, keep appending to the list until the consumer
+    // has drained it, otherwise newer tasks could overtake the older ones
+    if (!lane.overflowed.load(std::memory_order_acquire) && lane.queue.Push(std::move(task))) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(lane.overflow_mutex);
+    lane.overflow.push_back(std::move(task));
+    lane.overflowed.store(true, std::memory_order_release);
+}
+
+void Scheduler::RunPending() {
+    auto& high = lanes_[kSchedulePriorityHigh];
+    auto& normal = lanes_[kSchedulePriorityNormal];
+
+    // Tasks scheduled by the normal tasks themselves wait for the next round
+    size_t budget = normal.pending.load(std::memory_order_relaxed);
+    RunAll(high);
+    Task task;
+    while (budget-- > 0 && Pop(normal, task)) {
+        Run(normal, task);
+        RunAll(high);
+    }
+}
+
+bool Scheduler::Pop(Lane& lane, Task& task) {
+    if (!lane.queue.Pop(task)) {
+        if (!lane.overflowed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(lane.overflow_mutex);
+        if (lane.overflow.empty()) {
+            lane.overflowed.store(false, std::memory_order_release);
+            return false;
+        }
+        task = std::move(lane.overflow.front());
+        lane.overflow.pop_front();
+        if (lane.overflow.empty()) {
+            lane.overflowed.store(false, std::memory_order_release);
+        }
+        lane.stats.overflows++;
+    }
+    lane.pending.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Scheduler::Run(Lane& lane, Task& task) {
+    uint32_t latency = esp_timer_get_time() - task.enqueue_time;
+    lane.stats.tasks++;
+    lane.stats.total_latency_us += latency;
+    if (latency > lane.stats.max_latency_us) {
+        lane.stats.max_latency_us = latency;
+    }
+    task.callback();
+    task.callback = nullptr;
+}
+
+void Scheduler::RunAll(Lane& lane) {
+    size_t budget = lane.pending.load(std::memory_order_relaxed);
+    Task task;
+    while (budget-- > 0 && Pop(lane, task)) {
+        Run(lane, task);
+    }
+}
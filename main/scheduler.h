@@ -0,0 +1,66 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <functional>
+#include <mutex>
+#include <list>
+#include <atomic>
+#include <cstdint>
+
+#include "mpsc_queue.h"
+
+#define SCHEDULER_LANE_CAPACITY 64
+
+enum SchedulePriority {
+    kSchedulePriorityHigh,      // Audio critical work, e.g. sending encoded frames
+    kSchedulePriorityNormal,    // UI, IoT and state changes
+    kSchedulePriorityCount
+};
+
+struct ScheduleLaneStats {
+    uint32_t tasks = 0;
+    uint32_t overflows = 0;
+    uint64_t total_latency_us = 0;
+    uint32_t max_latency_us = 0;
+
+    inline uint32_t average_latency_us() const { return tasks > 0 ? total_latency_us / tasks : 0; }
+};
+
+// Work queue of the main loop. Producers on any task push without taking a lock;
+// when a lane's ring is full the callback goes to a locked overflow list instead
+// of being lost. The high priority lane is drained before and between the normal
+// tasks, so a slow UI or IoT callback delays audio by one task at most.
+class Scheduler {
+public:
+    void Push(std::function<void()>&& callback, SchedulePriority priority);
+    // Consumer side, runs the tasks queued so far
+    void RunPending();
+
+    inline const ScheduleLaneStats& stats(SchedulePriority priority) const { return lanes_[priority].stats; }
+    inline size_t pending(SchedulePriority priority) const {
+        return lanes_[priority].pending.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Task {
+        std::function<void()> callback;
+        int64_t enqueue_time = 0;
+    };
+
+    struct Lane {
+        MpscQueue<Task> queue{SCHEDULER_LANE_CAPACITY};
+        std::atomic<size_t> pending{0};
+        std::atomic<bool> overflowed{false};
+        std::mutex overflow_mutex;
+        std::list<Task> overflow;
+        ScheduleLaneStats stats;
+    };
+
+    Lane lanes_[kSchedulePriorityCount];
+
+    bool Pop(Lane& lane, Task& task);
+    void Run(Lane& lane, Task& task);
+    void RunAll(Lane& lane);
+};
+
+#endif // SCHEDULER_H
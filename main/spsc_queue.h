@@ -0,0 +1,86 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Fixed capacity single-producer / single-consumer ring.
+// Push() must only be called from one task and Pop() / Clear() from another,
+// no locks or heap allocations are involved after construction.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+        : slots_(capacity + 1) {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Returns false and counts an overflow if the queue is full
+    bool Push(T&& item) {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto next = Next(head);
+        if (next == tail_.load(std::memory_order_acquire)) {
+            overflow_count_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots_[head] = std::move(item);
+        head_.store(next, std::memory_order_release);
+
+        auto size = Size();
+        if (size > high_water_mark_.load(std::memory_order_relaxed)) {
+            high_water_mark_.store(size, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    bool Pop(T& item) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(slots_[tail]);
+        slots_[tail] = T();
+        tail_.store(Next(tail), std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side only, the dropped items are counted
+    void Clear() {
+        T item;
+        while (Pop(item)) {
+            drop_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool Empty() const {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+    size_t Size() const {
+        auto head = head_.load(std::memory_order_acquire);
+        auto tail = tail_.load(std::memory_order_acquire);
+        return head >= tail ? head - tail : head + slots_.size() - tail;
+    }
+
+    inline size_t capacity() const { return slots_.size() - 1; }
+    inline size_t overflow_count() const { return overflow_count_.load(std::memory_order_relaxed); }
+    inline size_t drop_count() const { return drop_count_.load(std::memory_order_relaxed); }
+    inline size_t high_water_mark() const { return high_water_mark_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<T> slots_;
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    std::atomic<size_t> overflow_count_{0};
+    std::atomic<size_t> drop_count_{0};
+    std::atomic<size_t> high_water_mark_{0};
+
+    inline size_t Next(size_t index) const {
+        return index + 1 == slots_.size() ? 0 : index + 1;
+    }
+};
+
+#endif // SPSC_QUEUE_H
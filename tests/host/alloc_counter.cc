@@ -0,0 +1,42 @@
+#include "host_test.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Counts every allocation of the program, so tests and benchmarks can check the
+// paths that are meant to run without touching the heap
+static std::atomic<size_t> allocation_count{0};
+
+size_t HostAllocationCount() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
@@ -0,0 +1,66 @@
+#include "host_bench.h"
+#include "afe_feed_buffer.h"
+
+#include <vector>
+
+#define ITERATIONS 20000
+
+// How the AFE wrappers fed afe->feed() before AfeFeedBuffer
+class LegacyFeedBuffer {
+public:
+    template <typename Feed>
+    void Append(const std::vector<int16_t>& data, size_t feed_size, Feed&& feed) {
+        input_buffer_.insert(input_buffer_.end(), data.begin(), data.end());
+        while (input_buffer_.size() >= feed_size) {
+            feed(input_buffer_.data());
+            input_buffer_.erase(input_buffer_.begin(), input_buffer_.begin() + feed_size);
+        }
+    }
+
+private:
+    std::vector<int16_t> input_buffer_;
+};
+
+// Feeds 30ms capture frames into a chunk size that does not divide them,
+// as with the 512 sample ESP-SR feed chunk
+static void Compare(const char* title, size_t frame_samples, size_t chunk_samples) {
+    std::vector<int16_t> frame(frame_samples);
+    for (size_t i = 0; i < frame_samples; i++) {
+        frame[i] = (int16_t)i;
+    }
+
+    // Both must hand the same chunks to the AFE
+    LegacyFeedBuffer legacy;
+    AfeFeedBuffer buffer;
+    buffer.Initialize(chunk_samples);
+    std::vector<int16_t> legacy_chunks, chunks;
+    for (int i = 0; i < 64; i++) {
+        legacy.Append(frame, chunk_samples, [&](const int16_t* chunk) {
+            legacy_chunks.insert(legacy_chunks.end(), chunk, chunk + chunk_samples);
+        });
+        buffer.Append(frame.data(), frame.size(), [&](const int16_t* chunk) {
+            chunks.insert(chunks.end(), chunk, chunk + chunk_samples);
+        });
+    }
+    CHECK(!chunks.empty());
+    CHECK(legacy_chunks == chunks);
+
+    int32_t sum = 0;
+    printf("%s, %zu sample frames into %zu sample chunks\n", title, frame_samples, chunk_samples);
+    HostBenchmark("vector insert + erase", ITERATIONS, [&]() {
+        legacy.Append(frame, chunk_samples, [&](const int16_t* chunk) { sum += chunk[0]; });
+    });
+    auto result = HostBenchmark("AfeFeedBuffer", ITERATIONS, [&]() {
+        buffer.Append(frame.data(), frame.size(), [&](const int16_t* chunk) { sum += chunk[0]; });
+    });
+    HostBenchKeep(sum);
+    CHECK(result.allocations_per_iteration == 0);
+}
+
+TEST(MonoFeed) {
+    Compare("Mono", 480, 512);
+}
+
+TEST(ReferenceChannelFeed) {
+    Compare("Mic + reference", 480 * 2, 512 * 2);
+}
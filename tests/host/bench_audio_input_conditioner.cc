@@ -0,0 +1,86 @@
+#include "host_bench.h"
+#include "audio_input_conditioner.h"
+
+#include <vector>
+
+#define INPUT_SAMPLE_RATE 24000
+#define ITERATIONS 20000
+
+// The resampling InputAudio did before AudioInputConditioner
+static void LegacyProcess(std::vector<int16_t>& data, int channels,
+    OpusResampler& input_resampler, OpusResampler& reference_resampler) {
+    if (channels == 2) {
+        auto mic_channel = std::vector<int16_t>(data.size() / 2);
+        auto reference_channel = std::vector<int16_t>(data.size() / 2);
+        for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
+            mic_channel[i] = data[j];
+            reference_channel[i] = data[j + 1];
+        }
+        auto resampled_mic = std::vector<int16_t>(input_resampler.GetOutputSamples(mic_channel.size()));
+        auto resampled_reference = std::vector<int16_t>(reference_resampler.GetOutputSamples(reference_channel.size()));
+        input_resampler.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
+        reference_resampler.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
+        data.resize(resampled_mic.size() + resampled_reference.size());
+        for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
+            data[j] = resampled_mic[i];
+            data[j + 1] = resampled_reference[i];
+        }
+    } else {
+        auto resampled = std::vector<int16_t>(input_resampler.GetOutputSamples(data.size()));
+        input_resampler.Process(data.data(), data.size(), resampled.data());
+        data = std::move(resampled);
+    }
+}
+
+// 30ms frames at 24kHz, resampled to 16kHz. The resampler is a stand-in,
+// so the timings show the cost of the copies and allocations around it.
+static void Compare(const char* title, int channels) {
+    std::vector<int16_t> frame(INPUT_SAMPLE_RATE / 1000 * 30 * channels);
+    for (size_t i = 0; i < frame.size(); i++) {
+        frame[i] = (int16_t)(i % 2 ? -(int)i : (int)i);
+    }
+
+    OpusResampler input_resampler, reference_resampler;
+    input_resampler.Configure(INPUT_SAMPLE_RATE, 16000);
+    reference_resampler.Configure(INPUT_SAMPLE_RATE, 16000);
+    AudioInputConditioner conditioner;
+    conditioner.Configure(INPUT_SAMPLE_RATE, channels);
+
+    auto legacy = frame;
+    auto data = frame;
+    LegacyProcess(legacy, channels, input_resampler, reference_resampler);
+    conditioner.Process(data);
+    CHECK_EQ(data.size(), frame.size() * 2 / 3);
+    CHECK(legacy == data);
+
+    // The capture buffer is refilled for every frame, as in ReadAudio
+    printf("%s, %zu samples per frame\n", title, frame.size());
+    HostBenchmark("per-frame vectors", ITERATIONS, [&]() {
+        legacy.assign(frame.begin(), frame.end());
+        LegacyProcess(legacy, channels, input_resampler, reference_resampler);
+        HostBenchKeep(legacy[0]);
+    });
+    auto result = HostBenchmark("AudioInputConditioner", ITERATIONS, [&]() {
+        data.assign(frame.begin(), frame.end());
+        conditioner.Process(data);
+        HostBenchKeep(data[0]);
+    });
+    CHECK(result.allocations_per_iteration == 0);
+}
+
+TEST(MonoInput) {
+    Compare("Mono", 1);
+}
+
+TEST(StereoInput) {
+    Compare("Mic + reference", 2);
+}
+
+TEST(SameRateIsPassThrough) {
+    AudioInputConditioner conditioner;
+    conditioner.Configure(16000, 2);
+    std::vector<int16_t> data = {1, 2, 3, 4};
+    conditioner.Process(data);
+    CHECK(!conditioner.resampling());
+    CHECK_EQ(data.size(), 4u);
+}
@@ -0,0 +1,71 @@
+#include "host_bench.h"
+#include "json_message.h"
+
+#include <cstring>
+#include <cstdlib>
+
+#if HOST_HAVE_CJSON
+#include <cJSON.h>
+#endif
+
+#define ITERATIONS 100000
+
+// The flat messages the server sends most, one per sentence or state change
+static const char* kMessages[] = {
+    "{\"session_id\":\"8f3a2c1e\",\"type\":\"tts\",\"state\":\"sentence_start\","
+        "\"text\":\"\\u4eca\\u5929\\u5929\\u6c14\\u600e\\u4e48\\u6837\\uff1f It is sunny.\"}",
+    "{\"session_id\":\"8f3a2c1e\",\"type\":\"stt\",\"text\":\"what is the weather like today\"}",
+    "{\"session_id\":\"8f3a2c1e\",\"type\":\"llm\",\"text\":\"\\ud83d\\ude00\",\"emotion\":\"happy\"}",
+    "{\"session_id\":\"8f3a2c1e\",\"type\":\"tts\",\"state\":\"stop\"}",
+};
+#define MESSAGE_COUNT (sizeof(kMessages) / sizeof(kMessages[0]))
+
+TEST(JsonMessageParse) {
+    JsonMessage message;
+    size_t lengths[MESSAGE_COUNT];
+    for (size_t i = 0; i < MESSAGE_COUNT; i++) {
+        lengths[i] = strlen(kMessages[i]);
+        CHECK(message.Parse(kMessages[i], lengths[i]));
+        CHECK(message.GetString("type") != nullptr);
+    }
+
+    printf("Parse and read type/state/text, %zu typical messages\n", MESSAGE_COUNT);
+    size_t index = 0;
+    auto result = HostBenchmark("JsonMessage", ITERATIONS, [&]() {
+        message.Parse(kMessages[index], lengths[index]);
+        HostBenchKeep(message.GetString("type"));
+        HostBenchKeep(message.GetString("state"));
+        HostBenchKeep(message.GetString("text"));
+        index = (index + 1) % MESSAGE_COUNT;
+    });
+    CHECK(result.allocations_per_iteration == 0);
+}
+
+#if HOST_HAVE_CJSON
+// cJSON allocates with malloc, count those calls too
+static size_t cjson_allocations = 0;
+
+static void* CountingMalloc(size_t size) {
+    cjson_allocations++;
+    return malloc(size);
+}
+
+TEST(CjsonParse) {
+    cJSON_Hooks hooks = {CountingMalloc, free};
+    cJSON_InitHooks(&hooks);
+
+    printf("Parse and read type/state/text, %zu typical messages\n", MESSAGE_COUNT);
+    size_t index = 0;
+    size_t allocations = cjson_allocations;
+    HostBenchmark("cJSON_Parse + GetObjectItem", ITERATIONS, [&]() {
+        auto root = cJSON_Parse(kMessages[index]);
+        HostBenchKeep(cJSON_GetObjectItem(root, "type"));
+        HostBenchKeep(cJSON_GetObjectItem(root, "state"));
+        HostBenchKeep(cJSON_GetObjectItem(root, "text"));
+        cJSON_Delete(root);
+        index = (index + 1) % MESSAGE_COUNT;
+    });
+    printf("  %-36s %10.1f mallocs\n", "cJSON", double(cjson_allocations - allocations) / (ITERATIONS + 1));
+    cJSON_InitHooks(nullptr);
+}
+#endif
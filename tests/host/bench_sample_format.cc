@@ -0,0 +1,93 @@
+#include "host_bench.h"
+#include "sample_format.h"
+
+#include <cmath>
+#include <vector>
+
+// 60ms of 24kHz output and 30ms of 16kHz input, the frames NoAudioCodec sees
+#define OUTPUT_SAMPLES 1440
+#define INPUT_SAMPLES 480
+#define ITERATIONS 20000
+
+// The conversions NoAudioCodec did before the sample format kernels
+static std::vector<int32_t> LegacyWrite(const int16_t* data, int samples, int volume) {
+    std::vector<int32_t> buffer(samples);
+    int32_t volume_factor = pow(double(volume) / 100.0, 2) * 65536;
+    for (int i = 0; i < samples; i++) {
+        int64_t temp = int64_t(data[i]) * volume_factor;
+        if (temp > INT32_MAX) {
+            buffer[i] = INT32_MAX;
+        } else if (temp < INT32_MIN) {
+            buffer[i] = INT32_MIN;
+        } else {
+            buffer[i] = static_cast<int32_t>(temp);
+        }
+    }
+    return buffer;
+}
+
+static void LegacyRead(const int32_t* slots, int16_t* dest, int samples) {
+    std::vector<int32_t> bit32_buffer(slots, slots + samples);
+    for (int i = 0; i < samples; i++) {
+        int32_t value = bit32_buffer[i] >> 12;
+        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    }
+}
+
+static std::vector<int16_t> Signal(int samples) {
+    std::vector<int16_t> signal(samples);
+    for (int i = 0; i < samples; i++) {
+        signal[i] = (int16_t)(sin(i * 0.05) * 30000);
+    }
+    return signal;
+}
+
+TEST(WriteConversion) {
+    auto signal = Signal(OUTPUT_SAMPLES);
+    std::vector<int32_t> slots(OUTPUT_SAMPLES);
+    int volume = 70;
+    int32_t gain = VolumeToGain(volume);
+
+    ScaleInt16ToInt32(signal.data(), slots.data(), OUTPUT_SAMPLES, gain);
+    auto legacy = LegacyWrite(signal.data(), OUTPUT_SAMPLES, volume);
+    int max_difference = 0;
+    for (int i = 0; i < OUTPUT_SAMPLES; i++) {
+        max_difference = std::max(max_difference, (int)std::abs((int64_t)slots[i] - legacy[i]) >> 16);
+    }
+    // The integer gain may differ from the pow() one by one Q16 step
+    CHECK(max_difference <= 1);
+
+    printf("Write, %d samples\n", OUTPUT_SAMPLES);
+    HostBenchmark("pow + int64 + vector", ITERATIONS, [&]() {
+        auto buffer = LegacyWrite(signal.data(), OUTPUT_SAMPLES, volume);
+        HostBenchKeep(buffer[0]);
+    });
+    auto kernel = HostBenchmark("ScaleInt16ToInt32", ITERATIONS, [&]() {
+        ScaleInt16ToInt32(signal.data(), slots.data(), OUTPUT_SAMPLES, gain);
+        HostBenchKeep(slots[0]);
+    });
+    CHECK(kernel.allocations_per_iteration == 0);
+}
+
+TEST(ReadConversion) {
+    std::vector<int32_t> slots(INPUT_SAMPLES);
+    for (int i = 0; i < INPUT_SAMPLES; i++) {
+        slots[i] = (int32_t)(sin(i * 0.05) * INT32_MAX);
+    }
+    std::vector<int16_t> legacy(INPUT_SAMPLES), dest(INPUT_SAMPLES);
+
+    LegacyRead(slots.data(), legacy.data(), INPUT_SAMPLES);
+    ShiftInt32ToInt16(slots.data(), dest.data(), INPUT_SAMPLES, 12);
+    CHECK(legacy == dest);
+
+    printf("Read, %d samples\n", INPUT_SAMPLES);
+    HostBenchmark("vector + ternary clamp", ITERATIONS, [&]() {
+        LegacyRead(slots.data(), legacy.data(), INPUT_SAMPLES);
+        HostBenchKeep(legacy[0]);
+    });
+    auto kernel = HostBenchmark("ShiftInt32ToInt16", ITERATIONS, [&]() {
+        ShiftInt32ToInt16(slots.data(), dest.data(), INPUT_SAMPLES, 12);
+        HostBenchKeep(dest[0]);
+    });
+    CHECK(kernel.allocations_per_iteration == 0);
+}
@@ -0,0 +1,39 @@
+#ifndef HOST_BENCH_H
+#define HOST_BENCH_H
+
+#include "host_test.h"
+
+#include <chrono>
+#include <cstdio>
+
+// Wall clock timings on the host only compare two implementations with each other,
+// they say nothing about the absolute cost on the ESP32
+struct HostBenchResult {
+    double ns_per_iteration = 0;
+    double allocations_per_iteration = 0;
+};
+
+// Keeps the compiler from dropping a computation whose result is never read
+template <typename T>
+static inline void HostBenchKeep(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+template <typename Body>
+HostBenchResult HostBenchmark(const char* name, int iterations, Body&& body) {
+    body();
+    size_t allocations = HostAllocationCount();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        body();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    HostBenchResult result;
+    result.ns_per_iteration = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    result.allocations_per_iteration = double(HostAllocationCount() - allocations) / iterations;
+    printf("  %-36s %10.1f ns %6.2f allocs\n", name, result.ns_per_iteration, result.allocations_per_iteration);
+    return result;
+}
+
+#endif // HOST_BENCH_H
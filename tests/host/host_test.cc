@@ -0,0 +1,29 @@
+#include "host_test.h"
+
+#include <cstring>
+
+std::vector<HostTestCase>& HostTestCases() {
+    static std::vector<HostTestCase> cases;
+    return cases;
+}
+
+int& HostTestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+// Runs every registered test, or only those whose name contains argv[1]
+int main(int argc, char** argv) {
+    int run = 0;
+    for (auto& test : HostTestCases()) {
+        if (argc > 1 && strstr(test.name, argv[1]) == nullptr) {
+            continue;
+        }
+        int failures = HostTestFailures();
+        test.function();
+        printf("%s %s\n", HostTestFailures() == failures ? "[ OK ]" : "[FAIL]", test.name);
+        run++;
+    }
+    printf("%d tests, %d failed checks\n", run, HostTestFailures());
+    return HostTestFailures() == 0 ? 0 : 1;
+}
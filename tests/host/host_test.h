@@ -0,0 +1,50 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <cstdio>
+#include <cstddef>
+#include <vector>
+
+// Minimal test registry for the host build, every test binary links host_test.cc for main()
+struct HostTestCase {
+    const char* name;
+    void (*function)();
+};
+
+std::vector<HostTestCase>& HostTestCases();
+int& HostTestFailures();
+
+struct HostTestRegistrar {
+    HostTestRegistrar(const char* name, void (*function)()) {
+        HostTestCases().push_back({name, function});
+    }
+};
+
+#define TEST(name) \
+    static void name(); \
+    static HostTestRegistrar name##_registrar(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            HostTestFailures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        auto a_value = (a); \
+        auto b_value = (b); \
+        if (!(a_value == b_value)) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, \
+                (long long)a_value, (long long)b_value); \
+            HostTestFailures()++; \
+        } \
+    } while (0)
+
+// Heap allocations made through operator new since the program started, see alloc_counter.cc
+size_t HostAllocationCount();
+
+#endif // HOST_TEST_H
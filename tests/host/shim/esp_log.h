@@ -0,0 +1,15 @@
+#ifndef HOST_SHIM_ESP_LOG_H
+#define HOST_SHIM_ESP_LOG_H
+
+// Logging is compiled out on the host, the arguments are still evaluated
+template <typename... Args>
+static inline void esp_log_discard(const char*, const char*, Args&&...) {
+}
+
+#define ESP_LOGE(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) esp_log_discard(tag, format, ##__VA_ARGS__)
+
+#endif // HOST_SHIM_ESP_LOG_H
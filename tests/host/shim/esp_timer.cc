@@ -0,0 +1,28 @@
+#include "esp_timer.h"
+
+#include <chrono>
+
+static bool fake_time_enabled = false;
+static int64_t fake_time_us = 0;
+
+int64_t esp_timer_get_time() {
+    if (fake_time_enabled) {
+        return fake_time_us;
+    }
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+void HostTimerSet(int64_t time_us) {
+    fake_time_enabled = true;
+    fake_time_us = time_us;
+}
+
+void HostTimerAdvance(int64_t delta_us) {
+    fake_time_enabled = true;
+    fake_time_us += delta_us;
+}
+
+void HostTimerRelease() {
+    fake_time_enabled = false;
+}
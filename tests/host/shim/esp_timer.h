@@ -0,0 +1,14 @@
+#ifndef HOST_SHIM_ESP_TIMER_H
+#define HOST_SHIM_ESP_TIMER_H
+
+#include <cstdint>
+
+// Microseconds of a monotonic clock, unless a test has taken over the time
+int64_t esp_timer_get_time();
+
+// Test control, the fake time is used from the first call until HostTimerRelease()
+void HostTimerSet(int64_t time_us);
+void HostTimerAdvance(int64_t delta_us);
+void HostTimerRelease();
+
+#endif // HOST_SHIM_ESP_TIMER_H
@@ -0,0 +1,34 @@
+#ifndef _OPUS_RESAMPLER_H_
+#define _OPUS_RESAMPLER_H_
+
+#include <cstdint>
+
+// Host stand-in for the esp-opus-encoder resampler, picks the nearest input
+// sample. Only the frame sizes matter to the code around it, not the filter.
+class OpusResampler {
+public:
+    void Configure(int input_sample_rate, int output_sample_rate) {
+        input_sample_rate_ = input_sample_rate;
+        output_sample_rate_ = output_sample_rate;
+    }
+
+    void Process(const int16_t* input, int input_samples, int16_t* output) {
+        int output_samples = GetOutputSamples(input_samples);
+        for (int i = 0; i < output_samples; i++) {
+            output[i] = input[(int64_t)i * input_sample_rate_ / output_sample_rate_];
+        }
+    }
+
+    int GetOutputSamples(int input_samples) const {
+        return (int64_t)input_samples * output_sample_rate_ / input_sample_rate_;
+    }
+
+    int input_sample_rate() const { return input_sample_rate_; }
+    int output_sample_rate() const { return output_sample_rate_; }
+
+private:
+    int input_sample_rate_ = 16000;
+    int output_sample_rate_ = 16000;
+};
+
+#endif // _OPUS_RESAMPLER_H_
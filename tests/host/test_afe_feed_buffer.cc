@@ -0,0 +1,79 @@
+#include "host_test.h"
+#include "afe_feed_buffer.h"
+
+#include <vector>
+
+// Feeds a counting signal in frames of the given size and checks every chunk
+static void CheckChunks(size_t chunk_samples, size_t frame_samples, size_t total_samples) {
+    AfeFeedBuffer buffer;
+    buffer.Initialize(chunk_samples);
+    std::vector<int16_t> signal(total_samples);
+    for (size_t i = 0; i < total_samples; i++) {
+        signal[i] = (int16_t)i;
+    }
+
+    size_t fed = 0;
+    bool continuous = true;
+    for (size_t offset = 0; offset < total_samples; offset += frame_samples) {
+        size_t samples = std::min(frame_samples, total_samples - offset);
+        buffer.Append(signal.data() + offset, samples, [&](const int16_t* chunk) {
+            for (size_t i = 0; i < chunk_samples; i++) {
+                continuous = continuous && chunk[i] == (int16_t)(fed + i);
+            }
+            fed += chunk_samples;
+        });
+    }
+    CHECK(continuous);
+    CHECK_EQ(fed, total_samples / chunk_samples * chunk_samples);
+}
+
+TEST(ChunksLargerThanTheFrame) {
+    CheckChunks(512, 480, 48000);
+}
+
+TEST(ChunksSmallerThanTheFrame) {
+    CheckChunks(256, 960, 48000);
+}
+
+TEST(StereoChunks) {
+    CheckChunks(512 * 2, 480 * 2, 96000);
+}
+
+TEST(OddSizes) {
+    CheckChunks(7, 3, 1000);
+    CheckChunks(3, 7, 1000);
+    CheckChunks(5, 5, 1000);
+}
+
+TEST(ClearDropsThePartialChunk) {
+    AfeFeedBuffer buffer;
+    buffer.Initialize(4);
+    int16_t data[] = {1, 2, 3, 4, 5, 6};
+    int chunks = 0;
+    buffer.Append(data, 2, [&](const int16_t*) { chunks++; });
+    buffer.Clear();
+    buffer.Append(data + 2, 4, [&](const int16_t* chunk) {
+        chunks++;
+        CHECK_EQ(chunk[0], 3);
+    });
+    CHECK_EQ(chunks, 1);
+}
+
+TEST(UninitializedBufferFeedsNothing) {
+    AfeFeedBuffer buffer;
+    int16_t data[4] = {};
+    int chunks = 0;
+    buffer.Append(data, 4, [&](const int16_t*) { chunks++; });
+    CHECK_EQ(chunks, 0);
+}
+
+TEST(AppendDoesNotAllocate) {
+    AfeFeedBuffer buffer;
+    buffer.Initialize(512);
+    std::vector<int16_t> frame(480);
+    size_t allocations = HostAllocationCount();
+    for (int i = 0; i < 100; i++) {
+        buffer.Append(frame.data(), frame.size(), [](const int16_t*) {});
+    }
+    CHECK_EQ(HostAllocationCount(), allocations);
+}
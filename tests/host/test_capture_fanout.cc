@@ -0,0 +1,145 @@
+#include "host_test.h"
+#include "capture_fanout.h"
+
+static void Write(CaptureFanout& fanout, int16_t value) {
+    auto frame = fanout.BeginWrite();
+    CHECK(frame != nullptr);
+    if (frame != nullptr) {
+        frame->data.assign(4, value);
+        frame->timestamp = value;
+        fanout.EndWrite();
+    }
+}
+
+TEST(EveryActiveConsumerReadsEveryFrame) {
+    CaptureFanout fanout(4);
+    int a = fanout.AddConsumer("a");
+    int b = fanout.AddConsumer("b");
+    fanout.SetActive(a, true);
+    fanout.SetActive(b, true);
+    Write(fanout, 1);
+    Write(fanout, 2);
+
+    int sum_a = 0, sum_b = 0;
+    fanout.Consume(a, [&](const CaptureFrame& frame) { sum_a += frame.data[0]; });
+    Write(fanout, 3);
+    fanout.Consume(a, [&](const CaptureFrame& frame) { sum_a += frame.data[0]; });
+    fanout.Consume(b, [&](const CaptureFrame& frame) { sum_b += frame.data[0]; });
+    CHECK_EQ(sum_a, 6);
+    CHECK_EQ(sum_b, 6);
+    CHECK_EQ(fanout.stats(a).frames, 3u);
+    CHECK_EQ(fanout.stats(a).dropped, 0u);
+}
+
+TEST(InactiveConsumersStartAtTheNextFrame) {
+    CaptureFanout fanout(4);
+    int a = fanout.AddConsumer("a");
+    Write(fanout, 1);
+    int count = 0;
+    fanout.Consume(a, [&](const CaptureFrame&) { count++; });
+    CHECK_EQ(count, 0);
+
+    fanout.SetActive(a, true);
+    Write(fanout, 2);
+    fanout.Consume(a, [&](const CaptureFrame& frame) { count++; CHECK_EQ(frame.data[0], 2); });
+    CHECK_EQ(count, 1);
+}
+
+TEST(SlowConsumerLosesItsOldestFrames) {
+    CaptureFanout fanout(4);
+    int a = fanout.AddConsumer("a");
+    fanout.SetActive(a, true);
+    for (int16_t i = 1; i <= 6; i++) {
+        Write(fanout, i);
+    }
+    std::vector<int16_t> seen;
+    fanout.Consume(a, [&](const CaptureFrame& frame) { seen.push_back(frame.data[0]); });
+    // The ring holds the last 4 frames, the 2 overwritten ones are counted as dropped
+    CHECK_EQ(seen.size(), 4u);
+    CHECK_EQ(seen.front(), 3);
+    CHECK_EQ(seen.back(), 6);
+    CHECK_EQ(fanout.stats(a).dropped, 2u);
+}
+
+TEST(PinnedFrameIsNeverOverwritten) {
+    CaptureFanout fanout(2);
+    int a = fanout.AddConsumer("a");
+    fanout.SetActive(a, true);
+    Write(fanout, 1);
+    Write(fanout, 2);
+    bool first = true;
+    fanout.Consume(a, [&](const CaptureFrame& frame) {
+        if (first) {
+            first = false;
+            // The reader holds the oldest frame, the producer has to skip this capture
+            CHECK(fanout.BeginWrite() == nullptr);
+            CHECK_EQ(frame.data[0], 1);
+        }
+    });
+    CHECK_EQ(fanout.overruns(), 1u);
+    Write(fanout, 3);
+}
+
+TEST(ConsumerLimit) {
+    CaptureFanout fanout;
+    for (int i = 0; i < CAPTURE_FANOUT_MAX_CONSUMERS; i++) {
+        CHECK_EQ(fanout.AddConsumer("c"), i);
+    }
+    CHECK_EQ(fanout.AddConsumer("extra"), -1);
+    int count = 0;
+    fanout.Consume(-1, [&](const CaptureFrame&) { count++; });
+    CHECK_EQ(count, 0);
+}
+
+TEST(SteadyStateDoesNotAllocate) {
+    CaptureFanout fanout(4);
+    int a = fanout.AddConsumer("a");
+    fanout.SetActive(a, true);
+    for (int16_t i = 0; i < 8; i++) {
+        Write(fanout, i);
+        fanout.Consume(a, [](const CaptureFrame&) {});
+    }
+    size_t allocations = HostAllocationCount();
+    for (int16_t i = 0; i < 100; i++) {
+        Write(fanout, i);
+        fanout.Consume(a, [](const CaptureFrame&) {});
+    }
+    CHECK_EQ(HostAllocationCount(), allocations);
+}
+
+TEST(LastReaderMayTakeTheSamples) {
+    CaptureFanout fanout(4);
+    int encoder = fanout.AddConsumer("encoder");
+    int detector = fanout.AddConsumer("detector");
+    fanout.SetActive(encoder, true);
+    Write(fanout, 1);
+
+    // Only active consumer, and an inactive one activated later starts after this frame
+    std::vector<int16_t> taken;
+    fanout.ConsumeOrTake(encoder, [&](CaptureFrame& frame, bool last_reader) {
+        CHECK(last_reader);
+        taken = std::move(frame.data);
+    });
+    CHECK_EQ(taken.size(), 4u);
+    fanout.SetActive(detector, true);
+
+    // The detector has not read this frame yet, the encoder must leave it alone
+    Write(fanout, 2);
+    fanout.ConsumeOrTake(encoder, [&](CaptureFrame&, bool last_reader) {
+        CHECK(!last_reader);
+    });
+    int detected = 0;
+    fanout.Consume(detector, [&](const CaptureFrame& frame) { detected += frame.data[0]; });
+    CHECK_EQ(detected, 2);
+
+    // The detector read first, so the encoder is the last one
+    Write(fanout, 3);
+    fanout.Consume(detector, [](const CaptureFrame&) {});
+    fanout.ConsumeOrTake(encoder, [&](CaptureFrame&, bool last_reader) {
+        CHECK(last_reader);
+    });
+
+    // A taken frame is refilled by the next write
+    Write(fanout, 4);
+    fanout.Consume(detector, [&](const CaptureFrame& frame) { CHECK_EQ(frame.data.size(), 4u); });
+}
@@ -0,0 +1,162 @@
+#include "host_test.h"
+#include "jitter_buffer.h"
+
+#include <esp_timer.h>
+
+#define FRAME_MS 60
+
+static AudioPacket Packet(uint32_t sequence, uint8_t value) {
+    auto packet = AudioPacketPool::GetInstance().Copy(&value, 1);
+    packet.set_sequence(sequence);
+    return packet;
+}
+
+// Returns the payload byte of the next frame, -1 for a concealed loss, 0 if nothing is ready
+static int Next(JitterBuffer& buffer) {
+    AudioPacket packet;
+    switch (buffer.Get(packet)) {
+    case kJitterBufferFrame:
+        return packet.data()[0];
+    case kJitterBufferLost:
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+TEST(PlaysInOrder) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS);
+    for (uint32_t i = 1; i <= 3; i++) {
+        buffer.Put(Packet(i, i));
+        HostTimerAdvance(FRAME_MS * 1000);
+    }
+    CHECK_EQ(Next(buffer), 1);
+    CHECK_EQ(Next(buffer), 2);
+    CHECK_EQ(Next(buffer), 3);
+    CHECK_EQ(Next(buffer), 0);
+    CHECK_EQ(buffer.stats().played, 3u);
+}
+
+TEST(ReordersPackets) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS);
+    buffer.Put(Packet(1, 1));
+    buffer.Put(Packet(3, 3));
+    buffer.Put(Packet(2, 2));
+    CHECK_EQ(Next(buffer), 1);
+    CHECK_EQ(Next(buffer), 2);
+    CHECK_EQ(Next(buffer), 3);
+}
+
+TEST(DropsLateAndDuplicatePackets) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS);
+    buffer.Put(Packet(1, 1));
+    buffer.Put(Packet(2, 2));
+    buffer.Put(Packet(2, 2));
+    CHECK_EQ(Next(buffer), 1);
+    buffer.Put(Packet(1, 1));
+    CHECK_EQ(buffer.stats().duplicated, 1u);
+    CHECK_EQ(buffer.stats().late, 1u);
+    CHECK_EQ(Next(buffer), 2);
+}
+
+TEST(ConcealsAShortGap) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS);
+    buffer.Put(Packet(1, 1));
+    buffer.Put(Packet(3, 3));
+    CHECK_EQ(Next(buffer), 1);
+    // Packet 2 gets the playout delay to arrive before it is concealed
+    HostTimerAdvance(FRAME_MS * 1000 * (buffer.target_frames() + 1));
+    CHECK_EQ(Next(buffer), -1);
+    CHECK_EQ(Next(buffer), 3);
+    CHECK_EQ(buffer.stats().lost, 1u);
+    CHECK_EQ(buffer.stats().concealed, 1u);
+}
+
+TEST(KeepsArrivalOrderWithoutSequenceNumbers) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS);
+    for (uint8_t i = 1; i <= 5; i++) {
+        buffer.Put(Packet(0, i));
+    }
+    for (int i = 1; i <= 5; i++) {
+        CHECK_EQ(Next(buffer), i);
+    }
+}
+
+TEST(BurstLargerThanTheBufferIsNotLost) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS, 8);
+    // The caller keeps what does not fit queued, as AudioPlayback does
+    int queued = 40, next = 1, played = 0;
+    while (queued > 0 || buffer.buffered() > 0) {
+        while (queued > 0 && buffer.HasRoom()) {
+            buffer.Put(Packet(0, (uint8_t)(41 - queued)));
+            queued--;
+        }
+        int value = Next(buffer);
+        if (value != 0) {
+            CHECK_EQ(value, next);
+            next++;
+            played++;
+        }
+        HostTimerAdvance(FRAME_MS * 1000);
+    }
+    CHECK_EQ(played, 40);
+    CHECK_EQ(buffer.stats().lost, 0u);
+}
+
+TEST(ResyncsOnASequenceJump) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS, 8);
+    buffer.Put(Packet(1, 1));
+    buffer.Put(Packet(100, 100));
+    CHECK_EQ(Next(buffer), 100);
+}
+
+TEST(FastBurstDoesNotInflateTheDelay) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS);
+    // A whole reply arrives at once, much faster than realtime
+    for (uint32_t i = 1; i <= 16; i++) {
+        buffer.Put(Packet(i, i));
+        HostTimerAdvance(1000);
+    }
+    CHECK_EQ(buffer.jitter_ms(), 0);
+    CHECK_EQ(buffer.target_frames(), 1);
+}
+
+TEST(LateArrivalsRaiseTheDelay) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS);
+    for (uint32_t i = 1; i <= 64; i++) {
+        buffer.Put(Packet(i, i));
+        Next(buffer);
+        // Every other packet is 100ms late
+        HostTimerAdvance(FRAME_MS * 1000 + (i % 2 ? 100000 : -100000));
+    }
+    CHECK(buffer.jitter_ms() > 20);
+    CHECK(buffer.target_frames() > 1);
+}
+
+TEST(CountsUnderrunsButNotTheEndOfAReply) {
+    HostTimerSet(1000000);
+    JitterBuffer buffer(FRAME_MS);
+    buffer.Put(Packet(1, 1));
+    CHECK_EQ(Next(buffer), 1);
+    CHECK_EQ(Next(buffer), 0);
+    CHECK_EQ(buffer.stats().underruns, 0u);
+    buffer.Put(Packet(2, 2));
+    CHECK_EQ(buffer.stats().underruns, 1u);
+
+    buffer.Reset();
+    buffer.Put(Packet(1, 1));
+    CHECK_EQ(Next(buffer), 1);
+    CHECK_EQ(Next(buffer), 0);
+    buffer.Reset();
+    buffer.Put(Packet(1, 1));
+    CHECK_EQ(buffer.stats().underruns, 0u);
+}
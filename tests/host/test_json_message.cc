@@ -0,0 +1,101 @@
+#include "host_test.h"
+#include "json_message.h"
+
+#include <cstring>
+#include <string>
+
+static bool Parse(JsonMessage& message, const char* json) {
+    return message.Parse(json, strlen(json));
+}
+
+TEST(ParsesFlatMessage) {
+    JsonMessage message;
+    CHECK(Parse(message, R"({"type":"tts","state":"sentence_start","text":"你好"})"));
+    CHECK_EQ(message.field_count(), 3);
+    CHECK(strcmp(message.GetString("type"), "tts") == 0);
+    CHECK(strcmp(message.GetString("state"), "sentence_start") == 0);
+    CHECK(strcmp(message.GetString("text"), "你好") == 0);
+    CHECK(message.GetString("emotion") == nullptr);
+    CHECK(!message.has_nested());
+}
+
+TEST(UnescapesStrings) {
+    JsonMessage message;
+    CHECK(Parse(message, R"({"text":"a\"b\\c\/d\n\t\u00e9\u4f60"})"));
+    CHECK(strcmp(message.GetString("text"), "a\"b\\c/d\n\t\xc3\xa9\xe4\xbd\xa0") == 0);
+}
+
+TEST(DecodesSurrogatePairs) {
+    JsonMessage message;
+    CHECK(Parse(message, R"({"emoji":"\ud83d\ude00"})"));
+    CHECK(strcmp(message.GetString("emoji"), "\xf0\x9f\x98\x80") == 0);
+    CHECK(!Parse(message, R"({"emoji":"\ud83d"})"));
+    CHECK(!Parse(message, R"({"emoji":"\ud83dA"})"));
+}
+
+TEST(ReadsNumbersAndLiterals) {
+    JsonMessage message;
+    CHECK(Parse(message, R"({"id":42,"negative":-7,"ok":true,"none":null,"name":"x"})"));
+    int value = 0;
+    CHECK(message.GetInt("id", value));
+    CHECK_EQ(value, 42);
+    CHECK(message.GetInt("negative", value));
+    CHECK_EQ(value, -7);
+    CHECK(!message.GetInt("ok", value));
+    CHECK(!message.GetInt("name", value));
+    CHECK(message.GetString("ok") == nullptr);
+}
+
+TEST(SkipsNestedValues) {
+    JsonMessage message;
+    CHECK(Parse(message, R"({"type":"iot","commands":[{"name":"a}\"]"},[1,2]],"after":"yes"})"));
+    CHECK(message.has_nested());
+    CHECK(strcmp(message.GetString("type"), "iot") == 0);
+    CHECK(strcmp(message.GetString("after"), "yes") == 0);
+    CHECK(message.GetString("commands") == nullptr);
+}
+
+TEST(AcceptsWhitespaceAndEmptyObject) {
+    JsonMessage message;
+    CHECK(Parse(message, " \r\n{ \"type\" :\t\"hello\" , \"version\" : 1 }\n"));
+    CHECK(strcmp(message.GetString("type"), "hello") == 0);
+    CHECK(Parse(message, "{}"));
+    CHECK_EQ(message.field_count(), 0);
+}
+
+TEST(RejectsMalformedInput) {
+    JsonMessage message;
+    CHECK(!Parse(message, ""));
+    CHECK(!Parse(message, "[]"));
+    CHECK(!Parse(message, R"({"type")"));
+    CHECK(!Parse(message, R"({"type":})"));
+    CHECK(!Parse(message, R"({"type":"tts")"));
+    CHECK(!Parse(message, R"({"type":"tts",})"));
+    CHECK(!Parse(message, R"({"type":tts})"));
+    CHECK(!Parse(message, R"({"text":"\x"})"));
+    CHECK(!Parse(message, R"({"nested":{"a":1})"));
+}
+
+TEST(RejectsMessagesLargerThanTheArena) {
+    JsonMessage message;
+    std::string text(JSON_MESSAGE_ARENA_SIZE, 'a');
+    std::string json = "{\"text\":\"" + text + "\"}";
+    CHECK(!message.Parse(json.data(), json.size()));
+
+    std::string fields = "{";
+    for (int i = 0; i <= JSON_MESSAGE_MAX_FIELDS; i++) {
+        fields += (i > 0 ? ",\"f" : "\"f") + std::to_string(i) + "\":1";
+    }
+    fields += "}";
+    CHECK(!message.Parse(fields.data(), fields.size()));
+}
+
+TEST(ParsesWithoutAllocating) {
+    static JsonMessage message;
+    const char* json = R"({"session_id":"abc","type":"llm","emotion":"happy","text":"\ud83d\ude00"})";
+    size_t allocations = HostAllocationCount();
+    for (int i = 0; i < 100; i++) {
+        CHECK(message.Parse(json, strlen(json)));
+    }
+    CHECK_EQ(HostAllocationCount(), allocations);
+}
@@ -0,0 +1,135 @@
+#include "host_test.h"
+#include "opus_controller.h"
+
+static OpusControllerInput Idle() {
+    OpusControllerInput input;
+    input.encoder_frame_duration_ms = 60;
+    return input;
+}
+
+// Records one frame whose encoding took load_percent of the frame duration
+static bool Sample(OpusController& controller, uint32_t load_percent, const OpusControllerInput& input = Idle()) {
+    controller.RecordEncode(load_percent * input.encoder_frame_duration_ms * 10, 1);
+    return controller.Update(input);
+}
+
+TEST(MeasuresEncodeLoad) {
+    OpusController controller;
+    controller.Reset(5, 60);
+    auto input = Idle();
+    controller.RecordEncode(30000, 2);
+    controller.Update(input);
+    CHECK_EQ(controller.encode_load(), 25u);
+}
+
+TEST(LowersComplexityAfterConsecutiveBusySamples) {
+    OpusController controller;
+    controller.Reset(5, 60);
+    CHECK(!Sample(controller, OPUS_CONTROLLER_LOAD_HIGH));
+    CHECK(Sample(controller, OPUS_CONTROLLER_LOAD_HIGH));
+    CHECK_EQ(controller.settings().complexity, 4);
+    CHECK(!Sample(controller, 90));
+    CHECK(Sample(controller, 90));
+    CHECK_EQ(controller.settings().complexity, 3);
+    CHECK_EQ(controller.decisions(), 2u);
+}
+
+TEST(NeverGoesBelowZero) {
+    OpusController controller;
+    controller.Reset(1, 60);
+    for (int i = 0; i < 10; i++) {
+        Sample(controller, 100);
+    }
+    CHECK_EQ(controller.settings().complexity, 0);
+}
+
+TEST(EncodeBacklogCountsAsCpuPressure) {
+    OpusController controller;
+    controller.Reset(3, 60);
+    auto input = Idle();
+    input.encode_backlog = OPUS_CONTROLLER_BACKLOG_FRAMES;
+    Sample(controller, 0, input);
+    CHECK(Sample(controller, 0, input));
+    CHECK_EQ(controller.settings().complexity, 2);
+}
+
+TEST(RecoversOneStepAfterGoodSamples) {
+    OpusController controller;
+    controller.Reset(5, 60);
+    Sample(controller, 80);
+    Sample(controller, 80);
+    CHECK_EQ(controller.settings().complexity, 4);
+    for (int i = 0; i < OPUS_CONTROLLER_RECOVER_SAMPLES - 1; i++) {
+        CHECK(!Sample(controller, 10));
+    }
+    CHECK(Sample(controller, 10));
+    CHECK_EQ(controller.settings().complexity, 5);
+    // Already at the ceiling
+    for (int i = 0; i < OPUS_CONTROLLER_RECOVER_SAMPLES * 2; i++) {
+        CHECK(!Sample(controller, 10));
+    }
+    CHECK_EQ(controller.settings().complexity, 5);
+}
+
+TEST(LoadBetweenThresholdsHoldsTheSetting) {
+    OpusController controller;
+    controller.Reset(5, 60);
+    Sample(controller, 80);
+    Sample(controller, 80);
+    for (int i = 0; i < OPUS_CONTROLLER_RECOVER_SAMPLES * 3; i++) {
+        CHECK(!Sample(controller, (OPUS_CONTROLLER_LOAD_LOW + OPUS_CONTROLLER_LOAD_HIGH) / 2));
+    }
+    CHECK_EQ(controller.settings().complexity, 4);
+}
+
+TEST(WeakNetworkProposesLongerFrames) {
+    OpusController controller;
+    controller.Reset(5, 20);
+    auto input = Idle();
+    input.encoder_frame_duration_ms = 20;
+    input.probes = 5;
+    input.loss_percent = OPUS_CONTROLLER_LOSS_PERCENT;
+    CHECK(!Sample(controller, 10, input));
+    CHECK(Sample(controller, 10, input));
+    CHECK_EQ(controller.settings().frame_duration_ms, OPUS_CONTROLLER_WEAK_FRAME_DURATION_MS);
+    CHECK_EQ(controller.settings().complexity, 5);
+
+    // Recovery restores the frame duration before anything else
+    input.loss_percent = 0;
+    for (int i = 0; i < OPUS_CONTROLLER_RECOVER_SAMPLES; i++) {
+        Sample(controller, 10, input);
+    }
+    CHECK_EQ(controller.settings().frame_duration_ms, 20);
+}
+
+TEST(LinkStatsAreIgnoredWithoutProbes) {
+    OpusController controller;
+    controller.Reset(5, 20);
+    auto input = Idle();
+    input.rtt_ms = OPUS_CONTROLLER_RTT_MS * 2;
+    for (int i = 0; i < 5; i++) {
+        CHECK(!Sample(controller, 10, input));
+    }
+    CHECK_EQ(controller.settings().frame_duration_ms, 20);
+}
+
+TEST(UserFrameDurationIsKeptWhileDegraded) {
+    OpusController controller;
+    controller.Reset(5, 20);
+    auto input = Idle();
+    input.send_backlog = OPUS_CONTROLLER_BACKLOG_FRAMES;
+    Sample(controller, 10, input);
+    Sample(controller, 10, input);
+    CHECK_EQ(controller.settings().frame_duration_ms, OPUS_CONTROLLER_WEAK_FRAME_DURATION_MS);
+
+    controller.SetFrameDuration(40);
+    CHECK_EQ(controller.settings().frame_duration_ms, OPUS_CONTROLLER_WEAK_FRAME_DURATION_MS);
+    input.send_backlog = 0;
+    for (int i = 0; i < OPUS_CONTROLLER_RECOVER_SAMPLES; i++) {
+        Sample(controller, 10, input);
+    }
+    CHECK_EQ(controller.settings().frame_duration_ms, 40);
+
+    controller.SetFrameDuration(120);
+    CHECK_EQ(controller.settings().frame_duration_ms, 120);
+}
@@ -0,0 +1,130 @@
+#include "host_test.h"
+#include "spsc_queue.h"
+#include "mpsc_queue.h"
+#include "inplace_function.h"
+
+#include <memory>
+#include <thread>
+
+TEST(SpscQueueIsFifoAndBounded) {
+    SpscQueue<int> queue(3);
+    CHECK_EQ(queue.capacity(), 3u);
+    CHECK(queue.Empty());
+    for (int i = 1; i <= 3; i++) {
+        CHECK(queue.Push(int(i)));
+    }
+    CHECK(!queue.Push(4));
+    CHECK_EQ(queue.overflow_count(), 1u);
+    CHECK_EQ(queue.Size(), 3u);
+    CHECK_EQ(queue.high_water_mark(), 3u);
+    int value = 0;
+    CHECK(queue.Pop(value));
+    CHECK_EQ(value, 1);
+    queue.Clear();
+    CHECK(queue.Empty());
+    CHECK_EQ(queue.drop_count(), 2u);
+    CHECK(!queue.Pop(value));
+}
+
+TEST(SpscQueueAcrossThreads) {
+    SpscQueue<int> queue(16);
+    const int count = 100000;
+    std::thread producer([&]() {
+        for (int i = 0; i < count; i++) {
+            while (!queue.Push(int(i))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    bool ordered = true;
+    for (int expected = 0; expected < count;) {
+        int value;
+        if (queue.Pop(value)) {
+            ordered = ordered && value == expected;
+            expected++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(ordered);
+}
+
+TEST(MpscQueueRoundsUpAndFills) {
+    MpscQueue<int> queue(5);
+    CHECK_EQ(queue.capacity(), 8u);
+    for (int i = 0; i < 8; i++) {
+        CHECK(queue.Push(int(i)));
+    }
+    CHECK(!queue.Push(8));
+    int value = -1;
+    for (int i = 0; i < 8; i++) {
+        CHECK(queue.Pop(value));
+        CHECK_EQ(value, i);
+    }
+    CHECK(!queue.Pop(value));
+}
+
+TEST(MpscQueueManyProducers) {
+    MpscQueue<int> queue(64);
+    const int per_thread = 20000;
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; t++) {
+        producers.emplace_back([&queue, t]() {
+            for (int i = 0; i < per_thread; i++) {
+                while (!queue.Push(t * per_thread + i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    // Items of one producer keep their order
+    std::vector<int> last(4, -1);
+    bool ordered = true;
+    for (int received = 0; received < 4 * per_thread;) {
+        int value;
+        if (queue.Pop(value)) {
+            int t = value / per_thread;
+            ordered = ordered && value > last[t];
+            last[t] = value;
+            received++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    CHECK(ordered);
+}
+
+TEST(InplaceFunctionMovesAndDestroysCaptures) {
+    auto counter = std::make_shared<int>(0);
+    {
+        InplaceFunction<32> function([counter]() { (*counter)++; });
+        CHECK_EQ(counter.use_count(), 2);
+        function();
+        InplaceFunction<32> moved(std::move(function));
+        CHECK(!function);
+        CHECK(bool(moved));
+        moved();
+        CHECK_EQ(counter.use_count(), 2);
+
+        InplaceFunction<32> assigned;
+        assigned = std::move(moved);
+        assigned();
+        assigned.Reset();
+        CHECK_EQ(counter.use_count(), 1);
+    }
+    CHECK_EQ(*counter, 3);
+}
+
+TEST(InplaceFunctionDoesNotAllocate) {
+    std::vector<int16_t> data(480);
+    size_t allocations = HostAllocationCount();
+    InplaceFunction<32> function([data = std::move(data)]() mutable { data[0] = 1; });
+    function();
+    InplaceFunction<32> moved(std::move(function));
+    moved();
+    CHECK_EQ(HostAllocationCount(), allocations);
+}
@@ -0,0 +1,51 @@
+#include "host_test.h"
+#include "sample_format.h"
+
+#include <cmath>
+#include <vector>
+
+TEST(VolumeCurve) {
+    CHECK_EQ(VolumeToGain(-5), 0);
+    CHECK_EQ(VolumeToGain(0), 0);
+    CHECK_EQ(VolumeToGain(100), 65536);
+    CHECK_EQ(VolumeToGain(150), 65536);
+    for (int volume = 1; volume < 100; volume++) {
+        double expected = pow(volume / 100.0, 2) * 65536;
+        CHECK(fabs(VolumeToGain(volume) - expected) <= 1.0);
+    }
+}
+
+TEST(ScaleMatchesTheScalarReference) {
+    std::vector<int16_t> src = {0, 1, -1, 100, -100, INT16_MAX, INT16_MIN, 12345, -12345};
+    std::vector<int32_t> dst(src.size());
+    for (int volume : {0, 1, 50, 70, 100}) {
+        int32_t gain = VolumeToGain(volume);
+        for (size_t samples = 0; samples <= src.size(); samples++) {
+            ScaleInt16ToInt32(src.data(), dst.data(), samples, gain);
+            for (size_t i = 0; i < samples; i++) {
+                CHECK_EQ(dst[i], (int32_t)((int64_t)src[i] * gain));
+            }
+        }
+    }
+}
+
+TEST(ShiftSaturates) {
+    std::vector<int32_t> src = {0, 1 << 12, -(1 << 12), INT32_MAX, INT32_MIN, 32767 << 12, -(32768 << 12), 5};
+    std::vector<int16_t> dst(src.size());
+    ShiftInt32ToInt16(src.data(), dst.data(), src.size(), 12);
+    CHECK_EQ(dst[0], 0);
+    CHECK_EQ(dst[1], 1);
+    CHECK_EQ(dst[2], -1);
+    CHECK_EQ(dst[3], INT16_MAX);
+    CHECK_EQ(dst[4], -INT16_MAX);
+    CHECK_EQ(dst[5], 32767);
+    CHECK_EQ(dst[6], -INT16_MAX);
+    CHECK_EQ(dst[7], 0);
+}
+
+TEST(SaturateBounds) {
+    CHECK_EQ(SaturateInt16(40000), INT16_MAX);
+    CHECK_EQ(SaturateInt16(-40000), -INT16_MAX);
+    CHECK_EQ(SaturateInt16(-32768), -INT16_MAX);
+    CHECK_EQ(SaturateInt16(1234), 1234);
+}
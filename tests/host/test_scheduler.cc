@@ -0,0 +1,84 @@
+#include "host_test.h"
+#include "scheduler.h"
+
+#include <string>
+#include <thread>
+
+TEST(RunsHighPriorityFirst) {
+    Scheduler scheduler;
+    std::string order;
+    scheduler.Push([&]() { order += "n1"; }, kSchedulePriorityNormal);
+    scheduler.Push([&]() { order += "h1"; }, kSchedulePriorityHigh);
+    scheduler.Push([&]() { order += "n2"; }, kSchedulePriorityNormal);
+    scheduler.Push([&]() { order += "h2"; }, kSchedulePriorityHigh);
+    CHECK_EQ(scheduler.pending(kSchedulePriorityNormal), 2u);
+    scheduler.RunPending();
+    CHECK(order == "h1h2n1n2");
+    CHECK_EQ(scheduler.pending(kSchedulePriorityNormal), 0u);
+    CHECK_EQ(scheduler.stats(kSchedulePriorityHigh).tasks, 2u);
+}
+
+TEST(HighPriorityRunsBetweenNormalTasks) {
+    Scheduler scheduler;
+    std::string order;
+    scheduler.Push([&]() {
+        order += "n1";
+        scheduler.Push([&]() { order += "h"; }, kSchedulePriorityHigh);
+    }, kSchedulePriorityNormal);
+    scheduler.Push([&]() { order += "n2"; }, kSchedulePriorityNormal);
+    scheduler.RunPending();
+    CHECK(order == "n1hn2");
+}
+
+TEST(TasksQueuedByNormalTasksWaitForTheNextRound) {
+    Scheduler scheduler;
+    int runs = 0;
+    scheduler.Push([&]() {
+        runs++;
+        scheduler.Push([&]() { runs++; }, kSchedulePriorityNormal);
+    }, kSchedulePriorityNormal);
+    scheduler.RunPending();
+    CHECK_EQ(runs, 1);
+    scheduler.RunPending();
+    CHECK_EQ(runs, 2);
+}
+
+TEST(OverflowKeepsTheOrder) {
+    Scheduler scheduler;
+    std::vector<int> order;
+    const int count = SCHEDULER_LANE_CAPACITY * 3;
+    for (int i = 0; i < count; i++) {
+        scheduler.Push([&order, i]() { order.push_back(i); }, kSchedulePriorityNormal);
+    }
+    scheduler.RunPending();
+    CHECK_EQ(order.size(), (size_t)count);
+    bool ordered = true;
+    for (int i = 0; i < (int)order.size(); i++) {
+        ordered = ordered && order[i] == i;
+    }
+    CHECK(ordered);
+    CHECK(scheduler.stats(kSchedulePriorityNormal).overflows > 0);
+}
+
+TEST(ConcurrentProducersLoseNothing) {
+    Scheduler scheduler;
+    int runs = 0;
+    const int per_thread = 2000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < per_thread; i++) {
+                scheduler.Push([&runs]() { runs++; }, i % 2 ? kSchedulePriorityHigh : kSchedulePriorityNormal);
+            }
+        });
+    }
+    while (runs < 4 * per_thread) {
+        scheduler.RunPending();
+        std::this_thread::yield();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    scheduler.RunPending();
+    CHECK_EQ(runs, 4 * per_thread);
+}